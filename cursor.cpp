@@ -0,0 +1,163 @@
+/**
+ * Cursor.cpp
+ * Implementation for the Cursor class.
+ */
+
+#include "cursor.h"
+
+/**
+ * Makes a cursor over a tree, positioned before its first account.
+ * @param tree tree to walk, it must not change while the cursor is used
+ */
+Cursor::Cursor(const UTree& tree): _tree(&tree), _denseDisc(INVALID_DISC), _current(nullptr), _disc(INVALID_DISC) {
+    rewind();
+}
+
+/**
+ * Moves to the next account that is not vacant.
+ * @return true if the cursor is at an account, false once it is past the last one
+ */
+bool Cursor::next() {
+    while (!_users.empty()){
+        if (nextAccount()) return true;
+
+        // every account of this username is done, on to the next username
+        UNode* user = _users.back();
+        _users.pop_back();
+        pushUsers(user->_right);
+        if (!_users.empty()) seekAccounts(_users.back(), INVALID_DISC);
+    }
+
+    // past the end the position stays at the last account, so a saved token still resumes there
+    if (_current){
+        _username = string(_current->getUsername());
+        _disc = _current->getDiscriminator();
+        _current = nullptr;
+    }
+    return false;
+}
+
+/**
+ * Copies out the next page of accounts.
+ * @param limit most accounts to copy out
+ * @param accounts the accounts are appended to it
+ * @return number of accounts appended, less than limit only once the walk is done
+ */
+int Cursor::fetch(int limit, std::vector<Account>& accounts) {
+    int count = 0;
+    while (count < limit && next()){
+        accounts.push_back(_current->getAccount());
+        count++;
+    }
+    return count;
+}
+
+/**
+ * Positions the cursor just after an account, which does not have to exist;
+ * next then moves to the first account that comes after it.
+ * @param username username of the position
+ * @param disc discriminator of the position, INVALID_DISC for before every account of username
+ */
+void Cursor::seek(std::string_view username, int disc) {
+    _users.clear();
+    _accounts.clear();
+    _current = nullptr;
+    _username = string(username);
+    _disc = disc;
+
+    // only the UNodes the path goes left at, and the one it ends at, are still ahead
+    UNode* node = _tree->_root;
+    while (node){
+        int compare = username.compare(node->getUsername());
+        if (compare < 0){
+            _users.push_back(node);
+            node = node->_left;
+        }else if (compare > 0){
+            node = node->_right;
+        }else{
+            _users.push_back(node);
+            break;
+        }
+    }
+    if (!_users.empty()) seekAccounts(_users.back(), _users.back()->getUsername() == username ? disc : INVALID_DISC);
+}
+
+/**
+ * Turns the position into a token, see resume.
+ * @return the discriminator and the username of the position, split by a colon
+ */
+string Cursor::save() const {
+    std::string_view username = _current ? _current->getUsername() : std::string_view(_username);
+    int disc = _current ? _current->getDiscriminator() : _disc;
+    return std::to_string(disc) + ":" + string(username);
+}
+
+/**
+ * Positions the cursor just after a position saved by save, on this tree or
+ * any other, see seek.
+ * @param token what save returned
+ * @return true if the token was read, false if it is malformed and the cursor did not move
+ */
+bool Cursor::resume(std::string_view token) {
+    // the discriminator goes first, so a username with a colon in it is still read whole
+    size_t colon = token.find(':');
+    int disc;
+    if (colon == std::string_view::npos || !UTree::parseInt(token.substr(0, colon), disc)) return false;
+    seek(token.substr(colon + 1), disc);
+    return true;
+}
+
+bool Cursor::nextAccount(){
+    const DTree* dtree = _users.back()->getDTree();
+    if (dtree->_dense){
+        _denseDisc = dtree->_dense->nextSet(_denseDisc);
+        if (_denseDisc == INVALID_DISC) return false;
+        _current = dtree->_dense->find(_denseDisc);
+        return true;
+    }
+
+    while (!_accounts.empty()){
+        DNode* node = _accounts.back();
+        _accounts.pop_back();
+        pushAccounts(node->_right);
+        if (node->isVacant()) continue;
+        _current = node;
+        return true;
+    }
+    return false;
+}
+
+void Cursor::pushUsers(UNode* node){
+    while (node){
+        _users.push_back(node);
+        node = node->_left;
+    }
+}
+
+void Cursor::pushAccounts(DNode* node){
+    // a subtree that is all vacant has nothing to walk
+    while (node && node->_size > node->_numVacant){
+        _accounts.push_back(node);
+        node = node->_left;
+    }
+}
+
+void Cursor::seekAccounts(UNode* user, int disc){
+    _accounts.clear();
+    const DTree* dtree = user->getDTree();
+    if (dtree->_dense){
+        _denseDisc = disc;
+        return;
+    }
+
+    // same as seek, only the nodes the path goes left at are still ahead
+    DNode* node = dtree->_root;
+    while (node && node->_size > node->_numVacant){
+        if (disc < node->getDiscriminator()){
+            _accounts.push_back(node);
+            node = node->_left;
+        }else{
+            node = node->_right;
+        }
+    }
+}
@@ -0,0 +1,53 @@
+/**
+ * Cursor.h
+ * An interface for the Cursor class, a walk over every account of a UTree
+ * in (username, discriminator) order that can be put down and picked up again.
+ */
+
+#pragma once
+
+#include "utree.h"
+
+class Grader;   /* For grading purposes */
+class Tester;   /* Forward declaration for testing class */
+
+/**
+ * Walks the accounts of a UTree in order of username and then discriminator,
+ * skipping vacant nodes, with an explicit stack for the UTree and another for
+ * the DTree of the username it is in, so it never recurses and only holds
+ * O(log n) nodes however big the tree is.
+ *
+ * A cursor is only good while the tree does not change. What outlives it is
+ * its position, the username and discriminator it is at: save turns that into
+ * a token and resume seeks a cursor to just after it, on the same tree or on
+ * a changed one, which is how a directory gets paged one request at a time.
+ */
+class Cursor {
+    friend class Grader;
+    friend class Tester;
+
+public:
+    Cursor(const UTree& tree); // starts before the first account
+
+    bool next();
+    const DNode* current() const {return _current;}
+    int fetch(int limit, std::vector<Account>& accounts);
+    void seek(std::string_view username, int disc);
+    void rewind() {seek(DEFAULT_USERNAME, INVALID_DISC);}
+    string save() const;
+    bool resume(std::string_view token);
+
+private:
+    const UTree* _tree;
+    std::vector<UNode*> _users; // UNodes still to walk, the top one is the username being walked
+    std::vector<DNode*> _accounts; // DNodes of that username still to walk, unless its DTree is dense
+    int _denseDisc; // last discriminator walked when the DTree is dense
+    const DNode* _current; // account the cursor is at, nullptr before the first one and past the last one
+    string _username; // position when there is no current account
+    int _disc;
+
+    bool nextAccount(); // steps through the DTree at the top of _users, false once it is done
+    void pushUsers(UNode* node); // pushes the path down to the smallest username of a subtree
+    void pushAccounts(DNode* node); // pushes the path down to the smallest discriminator of a subtree with anything left in it
+    void seekAccounts(UNode* user, int disc); // starts the walk of a DTree just after disc
+};
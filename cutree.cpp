@@ -0,0 +1,241 @@
+/**
+ * CUTree.cpp
+ * Implementation for the ConcurrentUTree class.
+ */
+
+#include "cutree.h"
+
+ConcurrentUTree::ConcurrentUTree() {
+    _tree._pool.setConcurrent(true); // DTrees under different locks still share the pool
+    _tree._logWaits = false; // waiting is done by us, after the locks are let go
+}
+
+/**
+ * Loads a .csv file into the tree, see UTree::loadData.
+ */
+LoadReport ConcurrentUTree::loadData(string infile, bool append, int numThreads) {
+    std::unique_lock<TreeLock> tree(_lock);
+    // the load threads carve out of their own pools, only the merge touches the shared one
+    return _tree.loadData(infile, append, numThreads);
+}
+
+/**
+ * Inserts a batch of accounts at once, see UTree::bulkLoad.
+ */
+int ConcurrentUTree::bulkLoad(std::vector<AccountRef>& accounts) {
+    std::unique_lock<TreeLock> tree(_lock);
+    return _tree.bulkLoad(accounts);
+}
+
+/**
+ * Writes the tree to a snapshot, see UTree::saveSnapshot.
+ */
+bool ConcurrentUTree::saveSnapshot(const string& path) {
+    std::unique_lock<TreeLock> tree(_lock);
+    return _tree.saveSnapshot(path);
+}
+
+/**
+ * Replaces the tree with a snapshot, see UTree::loadSnapshot.
+ */
+bool ConcurrentUTree::loadSnapshot(const string& path) {
+    std::unique_lock<TreeLock> tree(_lock);
+    return _tree.loadSnapshot(path);
+}
+
+/**
+ * Recovers the tree and starts logging, see UTree::openLog.
+ */
+bool ConcurrentUTree::openLog(const string& snapshotPath, const string& logPath, int syncEvery) {
+    std::unique_lock<TreeLock> tree(_lock);
+    return _tree.openLog(snapshotPath, logPath, syncEvery);
+}
+
+/**
+ * Folds the log into the snapshot, see UTree::checkpoint.
+ */
+bool ConcurrentUTree::checkpoint() {
+    std::unique_lock<TreeLock> tree(_lock);
+    return _tree.checkpoint();
+}
+
+/**
+ * Makes every change logged so far durable. Writers keep going meanwhile.
+ * @return true if every logged change is on disk
+ */
+bool ConcurrentUTree::syncLog() {
+    std::shared_lock<TreeLock> tree(_lock); // only keeps the log from being closed under us
+    return _tree.syncLog();
+}
+
+/**
+ * Makes every logged change durable and stops logging.
+ */
+void ConcurrentUTree::closeLog() {
+    std::unique_lock<TreeLock> tree(_lock);
+    _tree.closeLog();
+}
+
+/**
+ * Inserts an account, see UTree::insert.
+ * @param newAcct Account object to be inserted
+ * @return true if the account was inserted, false otherwise
+ */
+bool ConcurrentUTree::insert(const Account& newAcct) {
+    return insertHelper(AccountRef(newAcct));
+}
+
+/**
+ * Inserts an account built straight from its fields, see UTree::emplace.
+ * @return true if the account was inserted, false otherwise
+ */
+bool ConcurrentUTree::emplace(std::string_view username, int disc, bool nitro, std::string_view badge, std::string_view status) {
+    return insertHelper(AccountRef(username, disc, nitro, badge, status));
+}
+
+bool ConcurrentUTree::insertHelper(const AccountRef& account){
+    uint64_t ticket = 0;
+    bool inserted = false;
+    {
+        // the username usually exists already, then only its DTree changes
+        std::shared_lock<TreeLock> tree(_lock);
+        UNode* node = _tree.retrieve(account.username);
+        if (node){
+            std::unique_lock<NodeLock> guard(node->_lock);
+            DNode* added = nullptr;
+            node->_dtree.emplace(account, added);
+            inserted = added != nullptr;
+            if (inserted) ticket = _tree.logEnqueue(LOG_INSERT, account);
+        }else{
+            tree.unlock();
+            // someone may have added the username in between, UTree::emplace is fine with either
+            std::unique_lock<TreeLock> exclusive(_lock);
+            inserted = _tree.emplace(account.username, account.disc, account.nitro, account.badge, account.status);
+            if (inserted) ticket = lastTicket();
+        }
+    }
+    waitForLog(ticket);
+    return inserted;
+}
+
+/**
+ * Picks a free discriminator for the account's username and inserts the
+ * account with it, see UTree::allocateDiscriminator. The pick and the insert
+ * happen under one lock, so two threads never get the same discriminator.
+ * @param newAcct Account object to be inserted, its discriminator is ignored
+ * @param policy LOWEST_FREE for the smallest free discriminator, RANDOM_FREE for a uniformly random one
+ * @param rng random number generator used by RANDOM_FREE, owned by the calling thread
+ * @return the discriminator the account got, INVALID_DISC if the username has none left
+ */
+int ConcurrentUTree::allocateDiscriminator(const Account& newAcct, AllocPolicy policy, std::mt19937& rng) {
+    uint64_t ticket = 0;
+    int disc = INVALID_DISC;
+    {
+        std::shared_lock<TreeLock> tree(_lock);
+        UNode* node = _tree.retrieve(newAcct.getUsername());
+        if (node){
+            std::unique_lock<NodeLock> guard(node->_lock);
+            AccountRef account(newAcct);
+            account.disc = node->_dtree.findFree(policy, rng);
+            DNode* added = nullptr;
+            if (account.disc != INVALID_DISC) node->_dtree.emplace(account, added);
+            if (added){
+                disc = account.disc;
+                ticket = _tree.logEnqueue(LOG_INSERT, account);
+            }
+        }else{
+            tree.unlock();
+            std::unique_lock<TreeLock> exclusive(_lock);
+            disc = _tree.allocateDiscriminator(newAcct, policy, rng);
+            if (disc != INVALID_DISC) ticket = lastTicket();
+        }
+    }
+    waitForLog(ticket);
+    return disc;
+}
+
+/**
+ * Removes a user with a matching username and discriminator. Only the one
+ * DTree is locked for the removal; if that took the last account, the tree
+ * lock is then taken exclusively to unlink the UNode, like UTree::removeUser.
+ * @param username username to match
+ * @param disc discriminator to match
+ * @return true if an account was removed, false otherwise
+ */
+bool ConcurrentUTree::removeUser(std::string_view username, int disc) {
+    uint64_t ticket = 0;
+    bool done = false;
+    bool empty = false;
+    {
+        std::shared_lock<TreeLock> tree(_lock);
+        UNode* node = _tree.retrieve(username);
+        if (!node) return false;
+
+        std::unique_lock<NodeLock> guard(node->_lock);
+        done = node->_dtree.remove(disc);
+        if (done) ticket = _tree.logEnqueue(LOG_REMOVE, AccountRef(username, disc, false, "", ""));
+        empty = node->_dtree.getNumUsers() == 0;
+    }
+    if (empty){
+        // another writer may have put an account back in meanwhile, pruneUNode checks again
+        std::unique_lock<TreeLock> tree(_lock);
+        _tree.pruneUNode(username);
+    }
+    waitForLog(ticket);
+    return done;
+}
+
+/**
+ * Copies out the account of a user.
+ * @param username username to match
+ * @param disc discriminator to match
+ * @param found set to the account if the user exists
+ * @return true if the user exists
+ */
+bool ConcurrentUTree::retrieveUser(std::string_view username, int disc, Account& found) {
+    return visitUser(username, disc, [&](const DNode& user){found = user.getAccount();});
+}
+
+/**
+ * Checks if a user exists.
+ * @param username username to match
+ * @param disc discriminator to match
+ * @return true if the user exists
+ */
+bool ConcurrentUTree::hasUser(std::string_view username, int disc) {
+    return visitUser(username, disc, [](const DNode&){});
+}
+
+/**
+ * Returns the number of users with a specific username.
+ * @param username username to match
+ * @return number of users with the specified username
+ */
+int ConcurrentUTree::numUsers(std::string_view username) {
+    std::shared_lock<TreeLock> tree(_lock);
+    UNode* node = _tree.retrieve(username);
+    if (!node) return 0;
+    std::shared_lock<NodeLock> guard(node->_lock);
+    return node->_dtree.getNumUsers();
+}
+
+/**
+ * Removes every account.
+ */
+void ConcurrentUTree::clear() {
+    uint64_t ticket = 0;
+    {
+        std::unique_lock<TreeLock> tree(_lock);
+        _tree.clear();
+        ticket = lastTicket();
+    }
+    waitForLog(ticket);
+}
+
+uint64_t ConcurrentUTree::lastTicket(){
+    return _tree._log.isOpen() ? _tree._log.getNumAppended() : 0;
+}
+
+void ConcurrentUTree::waitForLog(uint64_t ticket){
+    if (ticket) _tree._log.wait(ticket);
+}
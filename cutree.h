@@ -0,0 +1,88 @@
+/**
+ * CUTree.h
+ * An interface for the ConcurrentUTree class, a UTree that any number of
+ * threads can read and write at once.
+ */
+
+#pragma once
+
+#include "utree.h"
+#include <shared_mutex>
+#include <mutex>
+
+class Grader;   /* For grading purposes */
+class Tester;   /* Forward declaration for testing class */
+
+/**
+ * UTree shared between threads. Locking is in two levels: a reader-writer
+ * lock over the shape of the UTree, and the NodeLock of every UNode over its
+ * DTree.
+ *
+ * Anything that only touches the DTree of a username that already exists
+ * holds the tree lock shared and locks just that UNode, so readers of any
+ * username never wait on each other, and writers of different usernames never
+ * wait on each other's NodeLock. Writers do still meet in the NodePool: every
+ * DNode they allocate or free goes through its one mutex, so only the work
+ * around the allocation runs in parallel.
+ * A change to the shape of the UTree, a new username or the removal of an
+ * empty UNode, holds the tree lock exclusively and so holds up every reader
+ * and writer until it is done, and so do the whole-tree
+ * operations like loading, clearing and checkpointing. Logged changes wait
+ * for the log after every lock is let go, so a sync never holds anyone up
+ * but the threads it makes durable.
+ */
+class ConcurrentUTree {
+    friend class Grader;
+    friend class Tester;
+
+public:
+    ConcurrentUTree();
+    ConcurrentUTree(const ConcurrentUTree&) = delete;
+    ConcurrentUTree& operator=(const ConcurrentUTree&) = delete;
+
+    LoadReport loadData(string infile, bool append = true, int numThreads = 1);
+    int bulkLoad(std::vector<AccountRef>& accounts);
+    bool saveSnapshot(const string& path);
+    bool loadSnapshot(const string& path);
+    bool openLog(const string& snapshotPath, const string& logPath, int syncEvery = LOG_SYNC_EVERY);
+    bool checkpoint();
+    bool syncLog();
+    void closeLog();
+    bool insert(const Account& newAcct);
+    bool emplace(std::string_view username, int disc, bool nitro, std::string_view badge, std::string_view status);
+    int allocateDiscriminator(const Account& newAcct, AllocPolicy policy, std::mt19937& rng);
+    bool removeUser(std::string_view username, int disc);
+    bool retrieveUser(std::string_view username, int disc, Account& found);
+    bool hasUser(std::string_view username, int disc);
+    int numUsers(std::string_view username);
+    void clear();
+
+    /**
+     * Calls visitor with the account of a user while the account cannot
+     * change, so it can be read without being copied. The DNode must not be
+     * kept past the call.
+     * @param username username to match
+     * @param disc discriminator to match
+     * @param visitor called as visitor(const DNode&) if the user exists
+     * @return true if the user exists and was visited
+     */
+    template <class Visitor>
+    bool visitUser(std::string_view username, int disc, Visitor&& visitor) {
+        std::shared_lock<TreeLock> tree(_lock);
+        UNode* node = _tree.retrieve(username);
+        if (!node) return false;
+        std::shared_lock<NodeLock> guard(node->_lock);
+        DNode* user = node->_dtree.retrieve(disc);
+        if (!user) return false;
+        visitor(static_cast<const DNode&>(*user));
+        return true;
+    }
+
+private:
+    UTree _tree;
+    TreeLock _lock; // shared to use the shape of _tree, exclusive to change it
+
+    bool insertHelper(const AccountRef& account); // insert and emplace
+    uint64_t lastTicket(); // log ticket of the last change, only meaningful while holding _lock exclusively
+    void waitForLog(uint64_t ticket); // waits for a change to be durable, with no lock held
+};
@@ -7,11 +7,41 @@
 
 #include "dtree.h"
 
+string BadgeTable::_names[MAX_BADGES];
+std::atomic<int> BadgeTable::_count(1);
+std::mutex BadgeTable::_lock;
+std::atomic<int> DTree::_compactPercent(COMPACT_PERCENT);
+
+/**
+ * Finds the id of a badge, adding the badge to the table the first time it shows up.
+ * @param badge name of the badge
+ * @return id of the badge, INVALID_BADGE if it is new and the table is full
+ */
+int BadgeTable::intern(std::string_view badge) {
+    // published badges never change, so looking one up needs no lock
+    int count = _count.load(std::memory_order_acquire);
+    for (int id = 0; id < count; id++){
+        if (_names[id] == badge) return id;
+    }
+
+    std::lock_guard<std::mutex> guard(_lock);
+    count = _count.load(std::memory_order_relaxed);
+    for (int id = 0; id < count; id++){
+        if (_names[id] == badge) return id;
+    }
+    if (count == MAX_BADGES) return INVALID_BADGE;
+
+    _names[count] = badge;
+    _count.store(count + 1, std::memory_order_release);
+    return count;
+}
+
 /**
  * Destructor, deletes all dynamic memory.
  */
 DTree::~DTree() {
     clear();
+    if (_ownPool) delete _pool;
 }
 
 /**
@@ -20,7 +50,17 @@ DTree::~DTree() {
  * @return Deep copy of rhs
  */
 DTree& DTree::operator=(const DTree& rhs) {
-    if (this != &rhs) assignmentRoot(rhs._root);
+    if (this != &rhs){
+        clear();
+        if (rhs._dense){
+            _dense = pool()->make<DenseIndex>();
+            for (int disc = MIN_DISC; disc <= MAX_DISC; disc++){
+                if (rhs._dense->test(disc)) _dense->set(disc, copyNode(rhs._dense->find(disc)));
+            }
+        }else{
+            assignmentRoot(rhs._root);
+        }
+    }
     return *this;
     
 }
@@ -32,20 +72,186 @@ DTree& DTree::operator=(const DTree& rhs) {
  * @param newAcct Account object to be contained within the new DNode
  * @return true if the account was inserted, false otherwise
  */
-bool DTree::insert(Account newAcct) {
+bool DTree::insert(const Account& newAcct) {
+    DNode* inserted = nullptr;
+    return emplace(AccountRef(newAcct), inserted);
+}
+
+/**
+ * Inserts an account with a single descent of the tree. A taken discriminator
+ * is detected on the way down, so nothing is linked or resized in that case.
+ * @param newAcct Account object to be contained within the new DNode
+ * @param inserted set to the newly linked DNode, nullptr if nothing was inserted
+ * @return true if the account was inserted, false otherwise
+ */
+bool DTree::insert(const Account& newAcct, DNode*& inserted) {
+    return emplace(AccountRef(newAcct), inserted);
+}
+
+/**
+ * Inserts an account built straight from its fields, which are copied into
+ * the new DNode and nowhere else.
+ * @return true if the account was inserted, false otherwise
+ */
+bool DTree::emplace(std::string_view username, int disc, bool nitro, std::string_view badge, std::string_view status) {
+    DNode* inserted = nullptr;
+    return emplace(AccountRef(username, disc, nitro, badge, status), inserted);
+}
+
+/**
+ * Inserts an account from a view of its fields, see insert.
+ * @param account fields of the account to be contained within the new DNode
+ * @param inserted set to the newly linked DNode, nullptr if nothing was inserted
+ * @return true if the account was inserted, false otherwise
+ */
+bool DTree::emplace(const AccountRef& account, DNode*& inserted) {
+    inserted = nullptr;
+    if (!accepts(account)) return false;
+
+    if (_dense){
+        if (_dense->test(account.disc)) return false;
+        inserted = makeNode(account);
+        _dense->set(account.disc, inserted);
+        return true;
+    }
+
+    DNode** scapegoat = nullptr;
+    insertTraverse(account, this->_root, inserted, scapegoat);
+    if (!inserted) return false;
+
+    // only the highest unbalanced node on the path gets rebuilt, everything below it comes along
+    if (scapegoat) rebuildSubtree(scapegoat, account.disc);
+
+    if (getNumUsers() >= DENSE_THRESHOLD) toDense();
+    return true;
+}
+
+/**
+ * Inserts a run of accounts at once. Everything already in the DTree is
+ * flattened into a sorted vine, the accounts are merged into it and the
+ * result is built back up balanced in a single pass, so the whole load is
+ * linear instead of one descent per account.
+ * @param accounts accounts sorted by discriminator
+ * @param count number of accounts
+ * @return number of accounts inserted, rejected and taken discriminators are skipped like insert would
+ */
+int DTree::bulkLoad(const AccountRef* accounts, int count) {
+    int inserted = 0;
+    if (_dense){
+        // a dense DTree only grows here, so it stays dense and every account is one slot
+        for (int i = 0; i < count; i++){
+            if (!accepts(accounts[i]) || _dense->test(accounts[i].disc)) continue;
+            _dense->set(accounts[i].disc, makeNode(accounts[i]));
+            inserted++;
+        }
+        return inserted;
+    }
 
-    // edge case to see if the disc is already used
-    if (retrieveTraverse(newAcct.getDiscriminator(), this->_root) != nullptr) return false; // if it is in the lis
+    DNode* existing = nullptr;
+    vineTraverse(this->_root, existing);
+    this->_root = nullptr;
+
+    DNode* vine = nullptr;
+    DNode** tail = &vine;
+    DNode* last = nullptr;
+    int total = 0;
+    int i = 0;
+    while (i < count || existing){
+        DNode* node;
+        if (i < count && (!existing || accounts[i].disc < existing->getDiscriminator())){
+            const AccountRef& account = accounts[i++];
+            if (!accepts(account)) continue;
+            if (last && account.disc == last->getDiscriminator()) continue; // repeated in the input, the first one wins
+            node = makeNode(account);
+            inserted++;
+        }else{
+            if (i < count && accounts[i].disc == existing->getDiscriminator()){
+                i++; // discriminator is already taken
+                continue;
+            }
+            node = existing;
+            existing = existing->_right;
+        }
 
+        node->_right = nullptr;
+        *tail = node;
+        tail = &node->_right;
+        last = node;
+        total++;
+    }
 
-    // testing to see if the newly inserted node's discriminator matches the discriminator passed in 
-    insertTraverse(newAcct, this->_root);
-    updateSize(this->_root);
-    if (checkImbalance(this->_root)) this->_root = rebalance(_root); // rebalance the root if its imbalanced after the inserts
+    if (total >= DENSE_THRESHOLD){
+        _dense = pool()->make<DenseIndex>();
+        while (vine){
+            DNode* node = vine;
+            vine = vine->_right;
+            node->_right = nullptr;
+            node->_size = DEFAULT_SIZE;
+            node->_numVacant = DEFAULT_NUM_VACANT;
+            _dense->set(node->getDiscriminator(), node);
+        }
+    }else{
+        this->_root = buildTraverse(vine, total);
+    }
+    return inserted;
+}
 
-    if (retrieveTraverse(newAcct.getDiscriminator(), this->_root) != nullptr) return true;
+/**
+ * Inserts a sorted run of accounts with one descent of the tree. The run is
+ * split around every node it passes, so a node is visited once no matter how
+ * many accounts go below it, and the accounts that land on an empty spot are
+ * hung there as a balanced subtree. Nodes are only checked for imbalance on
+ * the way back up, once the whole run is in.
+ * @param accounts accounts sorted by discriminator
+ * @param count number of accounts
+ * @param results set to true for every account inserted; rejected accounts, taken
+ *        discriminators and repeats of a discriminator earlier in the run get false
+ * @return number of accounts inserted
+ */
+int DTree::insertBatch(const AccountRef* accounts, int count, bool* results) {
+    int inserted = 0;
+    if (_dense){
+        for (int i = 0; i < count; i++){
+            results[i] = accepts(accounts[i]) && !_dense->test(accounts[i].disc);
+            if (!results[i]) continue;
+            _dense->set(accounts[i].disc, makeNode(accounts[i]));
+            inserted++;
+        }
+        return inserted;
+    }
 
-    return false;
+    insertBatchTraverse(this->_root, accounts, results, count, inserted);
+    if (getNumUsers() >= DENSE_THRESHOLD) toDense();
+    return inserted;
+}
+
+/**
+ * Removes a sorted run of discriminators with one descent of the tree, see
+ * insertBatch. Nodes are left vacant the same way remove leaves them.
+ * @param discs discriminators sorted in ascending order
+ * @param count number of discriminators
+ * @param results set to true for every discriminator removed; missing ones, vacant
+ *        ones and repeats of a discriminator earlier in the run get false
+ * @return number of accounts removed
+ */
+int DTree::removeBatch(const int* discs, int count, bool* results) {
+    int removed = 0;
+    if (_dense){
+        for (int i = 0; i < count; i++){
+            DNode* node = retrieve(discs[i]);
+            results[i] = node != nullptr;
+            if (!node) continue;
+            _dense->reset(discs[i]);
+            freeNode(node);
+            removed++;
+        }
+        // only checked once the whole run is out, so a big removal switches back at most once
+        if (removed && getNumUsers() < DENSE_EXIT_THRESHOLD) toTree();
+        return removed;
+    }
+
+    removeBatchTraverse(this->_root, discs, results, count, removed);
+    return removed;
 }
 
 
@@ -53,26 +259,70 @@ bool DTree::insert(Account newAcct) {
 /**
  * Retrieves the specified Account within a DNode.
  * @param disc discriminator int to search for
- * @return DNode with a matching discriminator, nullptr otherwise
+ * @return DNode with a matching discriminator, nullptr otherwise, also when the account was removed
  */
 DNode* DTree::retrieve(int disc) {
-    return retrieveTraverse(disc, this->_root);
+    if (_dense) return (disc < MIN_DISC || disc > MAX_DISC) ? nullptr : _dense->find(disc);
+    DNode* node = retrieveTraverse(disc, this->_root);
+    return (node && !node->isVacant()) ? node : nullptr; // a vacant node only keeps its place in the tree
 }
 
 // /**
 //  * Helper for the destructor to clear dynamic memory.
 //  */
 void DTree::clear() {
+    if (_ownPool && std::is_trivially_destructible<DNode>::value){
+        // nothing else lives in our own pool, so it can be released all at once
+        _pool->clear();
+        this->_root = nullptr;
+        _dense = nullptr;
+        _username = nullptr;
+        _ownUsername = false;
+        return;
+    }
+
     clearTraverse(this->_root);
+    this->_root = nullptr;
+
+    if (_dense){
+        for (int disc = MIN_DISC; disc <= MAX_DISC; disc++) freeNode(_dense->find(disc));
+        _pool->destroy(_dense);
+        _dense = nullptr;
+    }
+    if (_ownUsername){
+        _pool->release(const_cast<char*>(_username), std::strlen(_username) + 1);
+        _username = nullptr;
+        _ownUsername = false;
+    }
 }
 
 // /**
 //  * Prints all accounts' details within the DTree.
 //  */
 void DTree::printAccounts() const {
+    if (_dense){
+        for (int disc = MIN_DISC; disc <= MAX_DISC; disc++){
+            if (_dense->test(disc)) cout << _dense->find(disc)->getAccount() << endl;
+        }
+        return;
+    }
     printTraverse(_root);
 }
 
+/**
+ * Dump the DTree in the '()' notation. A dense DTree has no shape, so
+ * each of its accounts is dumped as a leaf.
+ */
+void DTree::dump() const {
+    if (!_dense){
+        dump(_root);
+        return;
+    }
+    for (int disc = MIN_DISC; disc <= MAX_DISC; disc++){
+        if (_dense->test(disc)) dump(_dense->find(disc));
+    }
+}
+
 /**
  * Dump the DTree in the '()' notation.
  */
@@ -80,7 +330,7 @@ void DTree::dump(DNode* node) const {
     if(node == nullptr) return;
     cout << "(";
     dump(node->_left);
-    cout << node->getAccount().getDiscriminator() << ":" << node->getSize() << ":" << node->getNumVacant();
+    cout << node->getDiscriminator() << ":" << node->getSize() << ":" << node->getNumVacant();
     dump(node->_right);
     cout << ")";
 }
@@ -90,7 +340,185 @@ void DTree::dump(DNode* node) const {
  * @return number of non-vacant nodes
  */
 int DTree::getNumUsers() const {
-    return validTraverse(_root); 
+    if (_dense) return _dense->count();
+    if (!_root) return 0;
+    return _root->_size - _root->_numVacant;
+}
+
+/**
+ * Finds a discriminator that no node of the tree is using. The subtree sizes
+ * tell how many discriminators each subtree covers, so only one path is walked.
+ * @param policy LOWEST_FREE for the smallest free discriminator, RANDOM_FREE for a uniformly random one
+ * @param rng random number generator used by RANDOM_FREE
+ * @return free discriminator, INVALID_DISC if every discriminator is taken
+ */
+int DTree::findFree(AllocPolicy policy, std::mt19937& rng) const {
+    int used = getNumUsers(); // a vacant node's discriminator is free, an insert revives it
+    if (used >= NUM_DISCS) return INVALID_DISC;
+
+    int n = 0;
+    if (policy == RANDOM_FREE) n = std::uniform_int_distribution<>(0, NUM_DISCS - used - 1)(rng);
+
+    if (!_dense){
+        if (policy == LOWEST_FREE) return lowestFreeTraverse(_root, MIN_DISC);
+        return nthFreeTraverse(_root, MIN_DISC, n);
+    }
+
+    // the bits past MAX_DISC in the last word are never set, so stop at NUM_DISCS
+    for (int i = 0; i < DENSE_WORDS; i++){
+        uint64_t free = ~_dense->_bits[i];
+        int inWord = __builtin_popcountll(free);
+        if (i == DENSE_WORDS - 1) inWord -= DENSE_WORDS * 64 - NUM_DISCS;
+        if (n >= inWord){
+            n -= inWord;
+            continue;
+        }
+        for (; n > 0; n--) free &= free - 1; // drop the lowest n free bits
+        return MIN_DISC + i * 64 + __builtin_ctzll(free);
+    }
+    return INVALID_DISC;
+}
+
+/**
+ * Counts the users whose discriminator is smaller than disc.
+ * @param disc discriminator to rank, it does not need to be in the tree
+ * @return number of non-vacant nodes with a smaller discriminator
+ */
+int DTree::rank(int disc) const {
+    if (disc <= MIN_DISC) return 0;
+    if (disc > MAX_DISC) return getNumUsers();
+
+    int count = 0;
+    if (_dense){
+        int word = (disc - MIN_DISC) / 64;
+        for (int i = 0; i < word; i++) count += __builtin_popcountll(_dense->_bits[i]);
+        uint64_t below = (uint64_t(1) << ((disc - MIN_DISC) % 64)) - 1;
+        return count + __builtin_popcountll(_dense->_bits[word] & below);
+    }
+
+    DNode* node = _root;
+    while (node){
+        if (disc <= node->getDiscriminator()){
+            node = node->_left;
+        }else{
+            // the whole left subtree and the node itself are smaller
+            if (node->_left) count += node->_left->_size - node->_left->_numVacant;
+            if (!node->isVacant()) count++;
+            node = node->_right;
+        }
+    }
+    return count;
+}
+
+/**
+ * Finds the k-th user in discriminator order, skipping vacant nodes.
+ * @param k zero based position of the user
+ * @return DNode holding the k-th user, nullptr if there are not that many users
+ */
+DNode* DTree::select(int k) const {
+    if (k < 0 || k >= getNumUsers()) return nullptr;
+
+    if (_dense){
+        for (int i = 0; i < DENSE_WORDS; i++){
+            uint64_t bits = _dense->_bits[i];
+            int inWord = __builtin_popcountll(bits);
+            if (k >= inWord){
+                k -= inWord;
+                continue;
+            }
+            for (; k > 0; k--) bits &= bits - 1; // drop the lowest k users
+            return _dense->_slots[i * 64 + __builtin_ctzll(bits)];
+        }
+        return nullptr;
+    }
+
+    DNode* node = _root;
+    while (node){
+        int leftUsers = node->_left ? node->_left->_size - node->_left->_numVacant : 0;
+        if (k < leftUsers){
+            node = node->_left;
+            continue;
+        }
+        k -= leftUsers;
+        if (!node->isVacant()){
+            if (k == 0) return node;
+            k--;
+        }
+        node = node->_right;
+    }
+    return nullptr;
+}
+
+/**
+ * Picks a user uniformly at random.
+ * @param rng random number generator to draw from
+ * @return DNode holding the picked user, nullptr if the tree has no users
+ */
+DNode* DTree::sampleRandom(std::mt19937& rng) const {
+    int users = getNumUsers();
+    if (users == 0) return nullptr;
+    return select(std::uniform_int_distribution<>(0, users - 1)(rng));
+}
+
+/**
+ * Counts the users with a discriminator between lo and hi, inclusive.
+ * @param lo smallest discriminator to count
+ * @param hi largest discriminator to count
+ * @return number of non-vacant nodes in the range
+ */
+int DTree::countRange(int lo, int hi) const {
+    // clamped first, so hi + 1 cannot overflow
+    if (lo < MIN_DISC) lo = MIN_DISC;
+    if (hi > MAX_DISC) hi = MAX_DISC;
+    if (lo > hi) return 0;
+    return rank(hi + 1) - rank(lo);
+}
+
+/**
+ * Calls callback on every user with a discriminator between lo and hi, inclusive,
+ * in discriminator order. Only the subtrees that overlap the range are visited.
+ * @param lo smallest discriminator to visit
+ * @param hi largest discriminator to visit
+ * @param callback function called with each user's DNode
+ */
+void DTree::forEachInRange(int lo, int hi, const std::function<void(DNode*)>& callback) const {
+    if (lo < MIN_DISC) lo = MIN_DISC;
+    if (hi > MAX_DISC) hi = MAX_DISC;
+    if (lo > hi) return;
+
+    if (!_dense){
+        rangeTraverse(_root, lo, hi, callback);
+        return;
+    }
+
+    for (int i = (lo - MIN_DISC) / 64; i <= (hi - MIN_DISC) / 64; i++){
+        uint64_t bits = _dense->_bits[i];
+        while (bits){
+            int disc = MIN_DISC + i * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            if (disc > hi) return;
+            if (disc >= lo) callback(_dense->find(disc));
+        }
+    }
+}
+
+/**
+ * Sets how many vacant nodes a subtree may hold before it is compacted, for
+ * every DTree. A removal that leaves a subtree with more vacant nodes than
+ * that rebuilds the highest such subtree without them, so a tree that loses
+ * most of its accounts shrinks with them instead of keeping the dead nodes.
+ * @param percent share of the subtree's nodes, 0 compacts on every removal and 100 never does
+ */
+void DTree::setCompactPercent(int percent) {
+    _compactPercent.store(std::max(0, std::min(percent, 100)), std::memory_order_relaxed);
+}
+
+/**
+ * Returns the username shared by every account in the tree.
+ * @return username of the accounts, DEFAULT_USERNAME if nothing was ever inserted
+ */
+std::string_view DTree::getUsername() const {
+    return _username ? std::string_view(_username) : DEFAULT_USERNAME;
 }
 
 
@@ -100,13 +528,11 @@ int DTree::getNumUsers() const {
  * @param node DNode object in which the size will be updated
  */
 void DTree::updateSize(DNode* node) {
-
-
     if (!node) return;
-    node->_size = 1 + countTraverse(node);
-    updateNumVacant(node); 
-    updateSize(node->_left);
-    updateSize(node->_right);
+
+    node->_size = 1;
+    if (node->_left) node->_size += node->_left->_size;
+    if (node->_right) node->_size += node->_right->_size;
 }
 
 
@@ -116,9 +542,10 @@ void DTree::updateSize(DNode* node) {
 //  */
 void DTree::updateNumVacant(DNode* node) {
     if (!node) return;
-    
-    
-    else if (node->isVacant()) node->_numVacant++;
+
+    node->_numVacant = node->isVacant() ? 1 : 0;
+    if (node->_left) node->_numVacant += node->_left->_numVacant;
+    if (node->_right) node->_numVacant += node->_right->_numVacant;
 }
 
 // /**
@@ -127,18 +554,16 @@ void DTree::updateNumVacant(DNode* node) {
 //  * @return (can change) returns true if an imbalance occured, false otherwise
 //  */
 bool DTree::checkImbalance(DNode* node) {
-    if (node && node->_left && node->_right){
-        
-        // For a "Discord" BST, we can define an imbalance to occur when one child's size is 
-        // 50% larger than the other child and at least one child's size is 4 or greater.
-        //cout << node->_left->_size << " " << node->_right->_size * 2 << endl;
-        if((node->_left->_size >= node->_right->_size * 2 && node->_left->_size > 3)
-            || (node->_right->_size >= node->_left->_size * 2 && node->_right->_size > 3)){
-            return true;
-        }else{
-            return false;
+    if (!node) return false;
 
-        }
+    // For a "Discord" BST, we can define an imbalance to occur when one child's size is 
+    // 50% larger than the other child and at least one child's size is 4 or greater.
+    // A missing child counts as a size of 0, otherwise a chain of single children never trips.
+    int left = node->_left ? node->_left->_size : 0;
+    int right = node->_right ? node->_right->_size : 0;
+
+    if((left >= right * 2 && left > 3) || (right >= left * 2 && right > 3)){
+        return true;
     }else{
         return false;
     }
@@ -152,23 +577,12 @@ bool DTree::checkImbalance(DNode* node) {
  */
 DNode* DTree::rebalance(DNode* node) { // balances tree based on the rules of a "Discord Tree"
 
-    DNode ** nodes = new DNode * [node->_size];
-
-    int * index = new int(0);
-    sortTraverse(nodes, node, index);
-
-
-
-    node = rebalanceTraverse(nodes, *index);
-    updateSize(node);
-
-
-    delete index;
-    delete [] nodes;
-    return node;
-
-
+    // the subtree is flattened into a sorted vine threaded through _right and rebuilt
+    // from it in place, so a rebuild never allocates no matter how big the subtree is
+    DNode* vine = nullptr;
+    int count = vineTraverse(node, vine);
 
+    return buildTraverse(vine, count);
 }
 
 
@@ -188,59 +602,175 @@ ostream& operator<<(ostream& sout, const Account& acct) {
 }
 
 /**
- * Removes the specified DNode from the tree.
+ * Removes the specified DNode from the tree. The node itself is left vacant,
+ * or given back to the pool, so nothing is allocated along the way.
  * @param disc discriminator to match
- * @param removed DNode object to hold removed account
  * @return true if an account was removed, false otherwise
  */
-bool DTree::remove(int disc, DNode*& removed) {
-    
-    delete removed;
-    removed = nullptr;
-    
-    removeTraverse(disc, this->_root, removed);
-    if(removed){
-        removed->_vacant = true;
-        //updateNumVacant(this->_root);
-        delete removed;
-        removed = nullptr;
+bool DTree::remove(int disc) {
+    return removeAccount(disc, nullptr);
+}
+
+/**
+ * Removes the specified DNode from the tree and hands back its account. The
+ * strings of the account are copied out, which can allocate; only remove(disc)
+ * is allocation-free.
+ * @param disc discriminator to match
+ * @param removed set to a copy of the removed account, left alone if nothing was removed
+ * @return true if an account was removed, false otherwise
+ */
+bool DTree::remove(int disc, Account& removed) {
+    return removeAccount(disc, &removed);
+}
+
+bool DTree::removeAccount(int disc, Account* removed){
+    if (_dense){
+        DNode* node = retrieve(disc);
+        if (!node) return false;
+
+        // a dense DTree has no shape to keep intact, so there is no need for a vacant node
+        if (removed) *removed = node->getAccount();
+        _dense->reset(disc);
+        freeNode(node);
+        if (getNumUsers() < DENSE_EXIT_THRESHOLD) toTree();
         return true;
-    }else{
-        return false;
     }
-    
 
+    DNode* node = nullptr;
+    DNode** compact = nullptr;
+    removeTraverse(disc, this->_root, node, compact);
+    if (!node) return false;
+
+    // read before the compaction, which frees the node
+    if (removed) *removed = node->getAccount();
+
+    // only the highest subtree past the threshold gets compacted, everything below it comes along
+    if (compact) compactSubtree(compact, disc);
+    return true;
 }
 
 
-void DTree::removeTraverse(int disc, DNode* node, DNode*& removed){ // returns a boolean based on whether the specified node was remove or not
+void DTree::removeTraverse(int disc, DNode*& node, DNode*& removed, DNode**& compact){ // returns a boolean based on whether the specified node was remove or not
     if (node == nullptr) return; // this may not work check back once u run
 
-    if (node->getAccount().getDiscriminator() == disc){
-        removed = new DNode(node->_account);
-        *removed = *node;
+    if (node->getDiscriminator() == disc){
+        if (node->isVacant()) return; // already removed
 
+        removed = node;
+        node->_vacant = true;
+        updateNumVacant(node);
+        if (overVacant(node)) compact = &node;
         return;
     }
 
+    if (disc < node->getDiscriminator())  removeTraverse(disc, node->_left, removed, compact);
+    if (disc > node->getDiscriminator())  removeTraverse(disc, node->_right, removed, compact);
+
+    // only the nodes on the path down to the removed node gain a vacancy
     if (removed){
         updateNumVacant(node);
+
+        // this runs from the bottom up, so the last subtree seen past the threshold is the highest one
+        if (overVacant(node)) compact = &node;
+    }
+}
+
+void DTree::compactSubtree(DNode** link, int disc){
+    rebuildSubtree(link, disc);
+
+    // the subtree shrank, which can tip an ancestor, and then the highest one tipped is rebuilt too
+    DNode** path = &this->_root;
+    while (path != link){
+        if (checkImbalance(*path)){
+            rebuildSubtree(path, disc);
+            return;
+        }
+        path = (disc < (*path)->getDiscriminator()) ? &(*path)->_left : &(*path)->_right;
+    }
+}
+
+bool DTree::overVacant(const DNode* node) const{
+    return node->_numVacant * 100 > node->_size * getCompactPercent();
+}
+
+void DTree::reviveNode(DNode* node, const AccountRef& account){
+    _pool->release(const_cast<char*>(node->_status), node->_statusLength);
+    node->_nitro = account.nitro;
+    node->_badge = BadgeTable::intern(account.badge);
+    node->_status = copyStatus(account.status.data(), account.status.size());
+    node->_statusLength = account.status.size();
+    node->_vacant = false;
+}
+
+
+NodePool* DTree::pool(){
+    if (!_pool){
+        _pool = new NodePool();
+        _ownPool = true;
     }
-    if (disc < node->getDiscriminator())  removeTraverse(disc, node->_left, removed);
-    if (disc > node->getDiscriminator())  removeTraverse(disc, node->_right, removed);
+    return _pool;
+}
 
-    return;
+DNode* DTree::makeNode(const AccountRef& account){
+    if (!_username){
+        char* username = static_cast<char*>(pool()->allocate(account.username.size() + 1));
+        std::memcpy(username, account.username.data(), account.username.size());
+        username[account.username.size()] = '\0';
+        _username = username;
+        _ownUsername = true;
+    }
 
+    DNode* node = pool()->make<DNode>();
+    node->_username = _username;
+    node->_disc = account.disc;
+    node->_nitro = account.nitro;
+    node->_badge = BadgeTable::intern(account.badge);
+    node->_status = copyStatus(account.status.data(), account.status.size());
+    node->_statusLength = account.status.size();
+    return node;
 }
 
+DNode* DTree::copyNode(const DNode* source){
+    if (!_username){
+        int length = std::strlen(source->_username);
+        char* username = static_cast<char*>(pool()->allocate(length + 1));
+        std::memcpy(username, source->_username, length + 1);
+        _username = username;
+        _ownUsername = true;
+    }
+
+    DNode* node = pool()->make<DNode>();
+    node->_username = _username;
+    node->_disc = source->_disc;
+    node->_nitro = source->_nitro;
+    node->_badge = source->_badge;
+    node->_status = copyStatus(source->_status, source->_statusLength);
+    node->_statusLength = source->_statusLength;
+    node->_vacant = source->_vacant;
+    return node;
+}
+
+const char* DTree::copyStatus(const char* status, int length){
+    if (length == 0) return nullptr; // most accounts have no status
+    char* copy = static_cast<char*>(pool()->allocate(length));
+    std::memcpy(copy, status, length);
+    return copy;
+}
+
+void DTree::freeNode(DNode* node){
+    if (!node) return;
+    _pool->release(const_cast<char*>(node->_status), node->_statusLength);
+    _pool->destroy(node);
+}
 
 void DTree::assignmentRoot(DNode* rhsRoot){ // assigns the root of the tree, before calling the recursive calls on the rest of the tree
     if (rhsRoot == nullptr) return;
 
-    _root = new DNode(rhsRoot->_account);
+    _root = copyNode(rhsRoot);
 
     _root->_size = rhsRoot->_size;
     _root->_numVacant = rhsRoot->_numVacant;
+    _root->_vacant = rhsRoot->_vacant;
     assignmentTraverse(_root, _root->_left, rhsRoot->_left, true);
     assignmentTraverse(_root, _root->_right, rhsRoot->_right, false);
 }
@@ -248,9 +778,10 @@ void DTree::assignmentRoot(DNode* rhsRoot){ // assigns the root of the tree, bef
 void DTree::assignmentTraverse(DNode* prev, DNode* node, DNode* rhsNode, bool leftRight){ // assigns the rest of the tree
     if (rhsNode == nullptr) return;
 
-    node = new DNode(rhsNode->_account);
+    node = copyNode(rhsNode);
     node->_size = rhsNode->_size;
     node->_numVacant = rhsNode->_numVacant;
+    node->_vacant = rhsNode->_vacant;
 
     if (leftRight) prev->_left = node;
     else prev->_right = node;
@@ -259,30 +790,6 @@ void DTree::assignmentTraverse(DNode* prev, DNode* node, DNode* rhsNode, bool le
     assignmentTraverse(node, node->_left, rhsNode->_left, true);
     assignmentTraverse(node, node->_right, rhsNode->_right, false);
     
-}
-
-int DTree::validTraverse(DNode* node) const{// returns the amount of non vacant nodes
-
-    
-    if (!node) {
-        return 0;
-
-
-    }else{
-        if (node->isVacant()){
-            return validTraverse(node->_left) + validTraverse(node->_right);
-        }else{
-            int count = 1;
-            count += validTraverse(node->_left);
-            count += validTraverse(node->_right);
-            return count;
-        }
-    }
-
-
-
-
-
 }
 
 DNode* DTree::retrieveTraverse(int disc, DNode* node){ //returns a specific node
@@ -304,9 +811,11 @@ DNode* DTree::retrieveTraverse(int disc, DNode* node){ //returns a specific node
 }
 
 void DTree::printTraverse(DNode* node) const{ // prints the accounts of the entire tree
-    if (!node) return;
-    cout << node->_account;
+    if (!node || node->_size == node->_numVacant) return;
+
+    // inorder, so the accounts come out by discriminator, and removed ones are left out
     printTraverse(node->_left);
+    if (!node->isVacant()) cout << node->getAccount() << endl;
     printTraverse(node->_right);
 }
 
@@ -314,157 +823,249 @@ void DTree::clearTraverse(DNode* node){ // traversal for destructor
     if(node){
         clearTraverse(node->_left);
         clearTraverse(node->_right);
-        delete node;
+        freeNode(node);
     }
 }
 
-int DTree::countTraverse(DNode* node){
-    if (!node) return 0;
+void DTree::insertTraverse(const AccountRef& account, DNode*& node, DNode*& inserted, DNode**& scapegoat){
+    // empty spot, this is where the account belongs
+    if (!node){
+        node = makeNode(account);
+        inserted = node;
+        return;
+    }
 
-    int count = 0;
-    if (node->_left) count++;
-    if (node->_right) count++;
+    if (account.disc == node->getDiscriminator()){
+        if (!node->isVacant()) return; // discriminator is already taken
 
-    return count + countTraverse(node->_left) + countTraverse(node->_right);
+        // a removed account's node is still here, it takes the new account and the tree keeps its shape
+        reviveNode(node, account);
+        updateNumVacant(node);
+        inserted = node;
+        return;
+    }
+
+    if (account.disc < node->getDiscriminator()) insertTraverse(account, node->_left, inserted, scapegoat);
+    else insertTraverse(account, node->_right, inserted, scapegoat);
+
+    if (inserted){
+        updateSize(node); // the new node is somewhere below, so this subtree grew by one, unless it was revived
+        updateNumVacant(node);
+
+        // this runs from the bottom up, so the last unbalanced node seen is the highest one
+        if (checkImbalance(node)) scapegoat = &node;
+    }
 }
 
-void DTree::insertTraverse(Account newAcct, DNode* node){
-    
-    //if list is empty we have to make a new one
-    if (!this->_root){
-        this->_root = new DNode(newAcct);
+void DTree::insertBatchTraverse(DNode*& node, const AccountRef* accounts, bool* results, int count, int& inserted){
+    if (count == 0) return;
+
+    // empty spot, the whole run belongs here and is built balanced off a vine
+    if (!node){
+        DNode* vine = nullptr;
+        DNode** tail = &vine;
+        int total = 0;
+        int last = INVALID_DISC;
+        for (int i = 0; i < count; i++){
+            results[i] = accepts(accounts[i]) && accounts[i].disc != last; // repeated in the run, the first one wins
+            if (!results[i]) continue;
+            last = accounts[i].disc;
+            *tail = makeNode(accounts[i]);
+            tail = &(*tail)->_right;
+            total++;
+        }
+        node = buildTraverse(vine, total);
+        inserted += total;
         return;
-    } 
+    }
 
-    if (node){
-        // theres no need to check is disc == node->_disc because that is checked
-        // by the retrieve function call in insert()
-        if (newAcct._disc < node->getDiscriminator()){
-
-            if (node->_left != nullptr){
-                insertTraverse(newAcct, node->_left); // 2
-
-            }else{
-                node->_left = new DNode(newAcct);
-                if (node->_left){
-                    if (checkImbalance(node->_left)){
-                        node->_left = rebalance(node->_left);
-                    }
-            }
+    // [0, lo) goes left, [lo, hi) has this node's discriminator, [hi, count) goes right
+    int disc = node->getDiscriminator();
+    int lo = std::lower_bound(accounts, accounts + count, disc, [](const AccountRef& a, int d){return a.disc < d;}) - accounts;
+    int hi = std::upper_bound(accounts + lo, accounts + count, disc, [](int d, const AccountRef& a){return d < a.disc;}) - accounts;
+    for (int i = lo; i < hi; i++){
+        // a vacant node is revived by the first account that could go in, the rest find it taken
+        results[i] = node->isVacant() && accepts(accounts[i]);
+        if (!results[i]) continue;
+        reviveNode(node, accounts[i]);
+        inserted++;
+    }
 
-                
-                 
-            }
-        } // NEEDS VACANT CHECK VACANCY CHECK VACANCY CHECK VACANCY CHECK VACANCY CHECK VACANCY CHECK VACANCY CHECK 
-        if (newAcct._disc > node->getDiscriminator()){
-
-            if (node->_right != nullptr){
-                insertTraverse(newAcct, node->_right); // 1
-
-            }else{
-                node->_right = new DNode(newAcct); // 3
-                if (node->_right){
-                    if (checkImbalance(node->_right)){
-                        node->_right = rebalance(node->_right);
-                    }
-                }
-                
-            }
+    insertBatchTraverse(node->_left, accounts, results, lo, inserted);
+    insertBatchTraverse(node->_right, accounts + hi, results + hi, count - hi, inserted);
 
+    // a rebuild below drops vacant nodes, so both counts are taken from the children again
+    updateSize(node);
+    updateNumVacant(node);
+    if (checkImbalance(node)) node = rebalance(node);
+}
+
+void DTree::removeBatchTraverse(DNode*& node, const int* discs, bool* results, int count, int& removed){
+    if (count == 0) return;
+    if (!node){
+        for (int i = 0; i < count; i++) results[i] = false;
+        return;
+    }
+
+    int disc = node->getDiscriminator();
+    int lo = std::lower_bound(discs, discs + count, disc) - discs;
+    int hi = std::upper_bound(discs + lo, discs + count, disc) - discs;
+    int before = removed;
+    for (int i = lo; i < hi; i++){
+        results[i] = !node->isVacant(); // a repeat finds the node already vacant
+        if (results[i]){
+            node->_vacant = true;
+            removed++;
         }
-                
     }
 
-    
+    removeBatchTraverse(node->_left, discs, results, lo, removed);
+    removeBatchTraverse(node->_right, discs + hi, results + hi, count - hi, removed);
 
+    // only the nodes above a removed node gain a vacancy, a compaction below can shrink them as well
+    if (removed != before){
+        updateSize(node);
+        updateNumVacant(node);
+        if (overVacant(node) || checkImbalance(node)) node = rebalance(node);
+    }
+}
 
+void DTree::rebuildSubtree(DNode** link, int disc){
+    // vacant nodes are dropped by the rebuild, so every ancestor loses them as well
+    int dropped = (*link)->_numVacant;
+    DNode** path = &this->_root;
+    while (path != link){
+        DNode* node = *path;
+        node->_size -= dropped;
+        node->_numVacant -= dropped;
+        path = (disc < node->getDiscriminator()) ? &node->_left : &node->_right;
+    }
 
+    *link = rebalance(*link);
+}
 
-    
+bool DTree::accepts(const AccountRef& account) const{
+    if (account.disc < MIN_DISC || account.disc > MAX_DISC) return false; // default accounts have no discriminator
+    if (_username && account.username != _username) return false; // every account of a DTree shares its username
+    if (account.status.size() > MAX_STATUS_LENGTH) return false;
+    return BadgeTable::intern(account.badge) != INVALID_BADGE; // interned here, so making the node later cannot fail
 }
 
-void DTree::sortTraverse(DNode ** array, DNode* node, int * count){
-    if (!node) return;
+int DTree::vineTraverse(DNode* node, DNode*& vine){
+    if (!node) return 0;
 
-    //inorder traversal for creating sorted array
-    sortTraverse(array, node->_left, count);
-    
-    if(node->isVacant()){
-        sortTraverse(array, node->_right, count);
-        delete node;
+    // reverse inorder traversal, pushing onto the front of the vine leaves it sorted
+    int count = vineTraverse(node->_right, vine);
+    DNode* left = node->_left;
+
+    if (node->isVacant()){
+        freeNode(node); // vacant nodes are dropped during a rebuild
     }else{
-        array[*count] = node; 
-        *count += 1;
-        sortTraverse(array, node->_right, count);
+        node->_left = nullptr;
+        node->_right = vine;
+        vine = node;
+        count++;
     }
 
+    return count + vineTraverse(left, vine);
+}
 
-    
 
-}
+DNode* DTree::buildTraverse(DNode*& vine, int count){
+    if (count == 0) return nullptr;
 
+    // even counts favor the left middle node over the right middle node
+    int middle = (count - 1) / 2;
 
-DNode* DTree::rebalanceTraverse(DNode ** nodes, int end){
-    // this should never run, but its here just in case
-    if (end == 0){
-        return nullptr;
-    }
+    // the left subtree is built first so it consumes the smallest nodes of the vine,
+    // which leaves the middle node at the front
+    DNode* left = buildTraverse(vine, middle);
+    DNode* newRoot = vine;
+    vine = vine->_right;
 
-    DNode* newRoot;
+    newRoot->_left = left;
+    newRoot->_right = buildTraverse(vine, count - middle - 1);
+    updateSize(newRoot);
+    updateNumVacant(newRoot);
+    return newRoot;
+}
 
-    // define new leaf nodes of the rebalanced tree
-    if (end == 1){
-        newRoot = nodes[0];
-        newRoot->_left = nullptr;
-        newRoot->_right = nullptr;
 
-        return newRoot;
+void DTree::toDense(){
+    _dense = pool()->make<DenseIndex>();
+    denseTraverse(this->_root);
+    this->_root = nullptr;
+}
 
-    }
+void DTree::denseTraverse(DNode* node){
+    if (!node) return;
 
+    denseTraverse(node->_left);
+    denseTraverse(node->_right);
 
-    if (end == 2){
-        newRoot = nodes[0];
-        newRoot->_left = nullptr;
-        DNode ** right = new DNode * [1];
-        right[0] = nodes[1];
-        newRoot->_right = rebalanceTraverse(right, 1);
-        delete [] right;
-        return newRoot;
+    if (node->isVacant()){
+        freeNode(node); // the dense index does not need vacant nodes
+        return;
     }
+    node->_left = nullptr;
+    node->_right = nullptr;
+    node->_size = DEFAULT_SIZE;
+    node->_numVacant = DEFAULT_NUM_VACANT;
+    _dense->set(node->getDiscriminator(), node);
+}
 
-    int middle;
-    
-    if (end % 2 == 0){
-         middle = end/2 - 1; // even arrays should favor the left middle node over the right middle node
-        
-     }else{
-         middle = end / 2; // say the length of the array is 11, 11/2 will be 5.5 rounded down to 5 b/c it is an integer
-    
+void DTree::toTree(){
+    DNode* vine = nullptr;
+    int count = denseVine(vine);
+    this->_root = buildTraverse(vine, count);
+}
+
+int DTree::denseVine(DNode*& vine){
+    // walking the slots backwards and pushing onto the front leaves the vine sorted
+    int count = 0;
+    for (int disc = MAX_DISC; disc >= MIN_DISC; disc--){
+        DNode* node = _dense->find(disc);
+        if (!node) continue;
+        node->_right = vine;
+        vine = node;
+        count++;
     }
 
-    newRoot = nodes[middle]; // middle node of array
+    _pool->destroy(_dense);
+    _dense = nullptr;
+    return count;
+}
 
+int DTree::lowestFreeTraverse(DNode* node, int lo) const{
+    // there is always a free discriminator at or above lo in this subtree's range
+    if (!node) return lo;
 
+    // the left subtree covers lo up to the node, if it holds fewer users than that there is a gap
+    int leftUsers = node->_left ? node->_left->_size - node->_left->_numVacant : 0;
+    if (leftUsers < node->getDiscriminator() - lo) return lowestFreeTraverse(node->_left, lo);
+    if (node->isVacant()) return node->getDiscriminator();
+    return lowestFreeTraverse(node->_right, node->getDiscriminator() + 1);
+}
 
-    DNode ** left = new DNode * [middle]; // left bisected array
-    for (int i = 0; i < middle; i++){// populate left bisected array
-        left[i] = nodes[i];
-    
-    }
-    
-    int rightEnd = end - middle - 1; // the -1 is to move the length down one to account for the middle node being ignored
-    DNode ** right = new DNode * [rightEnd]; // right bisected array
-    for (int i = middle + 1; i < end; i++){
-        right[i - middle - 1] = nodes[i]; // -1 is here for the same reason as it is in rightEnd
-    
-    }
+int DTree::nthFreeTraverse(DNode* node, int lo, int n) const{
+    if (!node) return lo + n;
 
-    newRoot->_left = rebalanceTraverse(left, middle);
-    newRoot->_right = rebalanceTraverse(right, rightEnd);
-    delete [] left;
-    delete [] right;
-    return newRoot;
+    int leftUsers = node->_left ? node->_left->_size - node->_left->_numVacant : 0;
+    int leftFree = node->getDiscriminator() - lo - leftUsers;
+    if (n < leftFree) return nthFreeTraverse(node->_left, lo, n);
+    n -= leftFree;
+    if (node->isVacant()){
+        if (n == 0) return node->getDiscriminator();
+        n--;
+    }
+    return nthFreeTraverse(node->_right, node->getDiscriminator() + 1, n);
+}
 
+void DTree::rangeTraverse(DNode* node, int lo, int hi, const std::function<void(DNode*)>& callback) const{
+    // subtrees that are completely vacant have nothing to report
+    if (!node || node->_size == node->_numVacant) return;
 
+    if (lo < node->getDiscriminator()) rangeTraverse(node->_left, lo, hi, callback);
+    if (lo <= node->getDiscriminator() && node->getDiscriminator() <= hi && !node->isVacant()) callback(node);
+    if (hi > node->getDiscriminator()) rangeTraverse(node->_right, lo, hi, callback);
 }
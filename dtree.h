@@ -7,9 +7,19 @@
 
 #pragma once
 
+#include "pool.h"
 #include <iostream>
 #include <string>
 #include <exception>
+#include <cstdint>
+#include <random>
+#include <functional>
+#include <type_traits>
+#include <atomic>
+#include <mutex>
+#include <cstring>
+#include <string_view>
+#include <algorithm>
 
 using std::cout;
 using std::endl;
@@ -26,8 +36,26 @@ using std::ostream;
 #define DEFAULT_SIZE 1
 #define DEFAULT_NUM_VACANT 0
 
+#define NUM_DISCS (MAX_DISC - MIN_DISC + 1)
+#define DENSE_WORDS ((NUM_DISCS + 63) / 64)
+#define DENSE_THRESHOLD 1024                    // users at which a DTree switches to the dense index
+#define DENSE_EXIT_THRESHOLD (DENSE_THRESHOLD / 4) // users at which it switches back to a tree
+#define COMPACT_PERCENT 50                      // share of vacant nodes past which a subtree is compacted by default
+
+#define MAX_BADGES 256              // distinct badges the badge table can hold
+#define INVALID_BADGE -1            // what the badge table gives a new badge once it is full
+#define MAX_STATUS_LENGTH 65535     // longest status a DNode can store
+
+/* How a free discriminator is picked when allocating one */
+enum AllocPolicy {
+    LOWEST_FREE,
+    RANDOM_FREE
+};
+
 class Grader;   /* For grading purposes */
 class Tester;   /* Forward declaration for testing class */
+struct SnapshotWriter;
+struct SnapshotReader;
 
 class Account {
 public:
@@ -35,6 +63,7 @@ public:
     friend class Tester;
     friend class DNode;
     friend class DTree;
+    friend class UTree;
     Account() {
         _username = DEFAULT_USERNAME;
         _disc = INVALID_DISC;
@@ -56,11 +85,11 @@ public:
     }
 
     /* Getters */
-    string getUsername() const {return _username;}
+    const string& getUsername() const {return _username;}
     int getDiscriminator() const {return _disc;}
     bool hasNitro() const {return _nitro;}
-    string getBadge() const {return _badge;}
-    string getStatus() const {return _status;}
+    const string& getBadge() const {return _badge;}
+    const string& getStatus() const {return _status;}
 
 private:
     string _username;
@@ -73,10 +102,52 @@ private:
 /* Overloaded << operator to print Accounts */
 ostream& operator<<(ostream& sout, const Account& acct);
 
+/**
+ * Borrowed view of an account's fields. Inserts go through one of these, so a
+ * DNode can be filled straight from wherever the fields already are without
+ * building an Account in between.
+ */
+struct AccountRef {
+    AccountRef(std::string_view username, int disc, bool nitro, std::string_view badge, std::string_view status):
+        username(username), disc(disc), nitro(nitro), badge(badge), status(status) {}
+    AccountRef(const Account& acct):
+        AccountRef(acct.getUsername(), acct.getDiscriminator(), acct.hasNitro(), acct.getBadge(), acct.getStatus()) {}
+
+    std::string_view username;
+    int disc;
+    bool nitro;
+    std::string_view badge;
+    std::string_view status;
+};
+
+/**
+ * Process wide table of badge names. There are only a handful of badges,
+ * so every DNode stores a one byte id instead of its own copy of the name.
+ * Once MAX_BADGES names are in, an account with yet another badge is turned
+ * down by whatever inserts it, the badges already in keep working.
+ */
+class BadgeTable {
+public:
+    static int intern(std::string_view badge);
+    static const string& name(uint8_t id) {return _names[id];}
+    static int count() {return _count.load(std::memory_order_acquire);}
+
+private:
+    static string _names[MAX_BADGES]; // id 0 is always DEFAULT_BADGE
+    static std::atomic<int> _count;
+    static std::mutex _lock; // only taken to add a badge nobody has seen yet
+};
+
+/**
+ * DNodes do not keep a whole Account. The username is the same for every node
+ * of a DTree, so it is kept once by the DTree, the badge is an id into the
+ * BadgeTable and the status lives in the DTree's node pool.
+ */
 class DNode {
     friend class Grader;
     friend class Tester;
     friend class DTree;
+    friend class Cursor;
 
 public:
     DNode() {
@@ -85,42 +156,101 @@ public:
         _vacant = false;
         _left = nullptr;
         _right = nullptr;
+        _username = nullptr;
+        _status = nullptr;
+        _statusLength = 0;
+        _disc = INVALID_DISC;
+        _badge = 0;
+        _nitro = false;
     }
 
-    DNode(Account account) {
-        _account = account;
-        _size = DEFAULT_SIZE;
-        _numVacant = DEFAULT_NUM_VACANT;
-        _vacant = false;
-        _left = nullptr;
-        _right = nullptr;
-    }
-
-    /* Getters */
-    Account getAccount() const {return _account;}
+    /* Getters, the string ones are views into the tree and are valid until the node is removed */
+    Account getAccount() const {return Account(string(getUsername()), _disc, _nitro, getBadge(), string(getStatus()));}
     int getSize() const {return _size;}
     int getNumVacant() const {return _numVacant;}
     bool isVacant() const {return _vacant;}
-    string getUsername() const {return _account.getUsername();}
-    int getDiscriminator() const {return _account.getDiscriminator();}
+    std::string_view getUsername() const {return _username ? std::string_view(_username) : DEFAULT_USERNAME;}
+    int getDiscriminator() const {return _disc;}
+    bool hasNitro() const {return _nitro;}
+    const string& getBadge() const {return BadgeTable::name(_badge);}
+    std::string_view getStatus() const {return std::string_view(_status, _statusLength);}
 
 private:
-    Account _account;
+    DNode* _left;
+    DNode* _right;
+    const char* _username; // owned by the DTree
+    const char* _status; // owned by the DTree's node pool, not null terminated
     int _size;
     int _numVacant;
+    uint16_t _statusLength;
+    int16_t _disc;
+    uint8_t _badge;
+    bool _nitro;
     bool _vacant;
-    DNode* _left;
-    DNode* _right;
 
     /* IMPLEMENT (optional): any other helper functions */
 };
 
+/**
+ * Dense backing for a DTree with a lot of users. Since discriminators are bounded,
+ * every possible discriminator gets a presence bit and a direct slot, so lookups
+ * never have to chase pointers down the tree.
+ */
+class DenseIndex {
+    friend class Grader;
+    friend class Tester;
+    friend class DTree;
+
+public:
+    DenseIndex(): _bits(), _slots() {}
+
+    bool test(int disc) const {return (_bits[(disc - MIN_DISC) / 64] >> ((disc - MIN_DISC) % 64)) & 1;}
+    DNode* find(int disc) const {return test(disc) ? _slots[disc - MIN_DISC] : nullptr;}
+
+    void set(int disc, DNode* node) {
+        _bits[(disc - MIN_DISC) / 64] |= uint64_t(1) << ((disc - MIN_DISC) % 64);
+        _slots[disc - MIN_DISC] = node;
+    }
+
+    void reset(int disc) {
+        _bits[(disc - MIN_DISC) / 64] &= ~(uint64_t(1) << ((disc - MIN_DISC) % 64));
+        _slots[disc - MIN_DISC] = nullptr;
+    }
+
+    // first discriminator past disc that is set, INVALID_DISC if there is none
+    int nextSet(int disc) const {
+        int from = disc < MIN_DISC ? 0 : disc - MIN_DISC + 1;
+        if (from >= NUM_DISCS) return INVALID_DISC;
+        int i = from / 64;
+        uint64_t bits = _bits[i] & (~uint64_t(0) << (from % 64));
+        while (!bits){
+            if (++i == DENSE_WORDS) return INVALID_DISC;
+            bits = _bits[i];
+        }
+        return MIN_DISC + i * 64 + __builtin_ctzll(bits);
+    }
+
+    int count() const {
+        int total = 0;
+        for (int i = 0; i < DENSE_WORDS; i++) total += __builtin_popcountll(_bits[i]);
+        return total;
+    }
+
+private:
+    uint64_t _bits[DENSE_WORDS];
+    DNode* _slots[NUM_DISCS];
+};
+
 class DTree {
     friend class Grader;
     friend class Tester;
+    friend class UTree;
+    friend class Cursor;
 
 public:
-    DTree(): _root(nullptr) {}
+    DTree(): DTree(nullptr) {}
+    DTree(NodePool* pool): _root(nullptr), _dense(nullptr), _pool(pool), _ownPool(false), _username(nullptr), _ownUsername(false) {}
+    DTree(const DTree& rhs): DTree() {*this = rhs;}
 
     /* IMPLEMENT: destructor and assignment operator*/
     ~DTree();
@@ -128,18 +258,34 @@ public:
 
     /* IMPLEMENT: Basic operations */
 
-    bool insert(Account newAcct);
-    bool remove(int disc, DNode*& removed);
+    bool insert(const Account& newAcct);
+    bool insert(const Account& newAcct, DNode*& inserted);
+    bool emplace(std::string_view username, int disc, bool nitro, std::string_view badge, std::string_view status);
+    bool emplace(const AccountRef& account, DNode*& inserted);
+    int bulkLoad(const AccountRef* accounts, int count);
+    int insertBatch(const AccountRef* accounts, int count, bool* results);
+    int removeBatch(const int* discs, int count, bool* results);
+    bool remove(int disc);
+    bool remove(int disc, Account& removed);
     DNode* retrieve(int disc);
     void clear();
     void printAccounts() const;
-    void dump() const {dump(_root);}
+    void dump() const;
     void dump(DNode* node) const;
 
     /* IMPLEMENT: "Helper" functions */
 
     int getNumUsers() const;
-    string getUsername() const {return _root->getUsername();}
+    int findFree(AllocPolicy policy, std::mt19937& rng) const;
+    int rank(int disc) const;
+    DNode* select(int k) const;
+    DNode* sampleRandom(std::mt19937& rng) const;
+    int countRange(int lo, int hi) const;
+    void forEachInRange(int lo, int hi, const std::function<void(DNode*)>& callback) const;
+    std::string_view getUsername() const;
+    bool isDense() const {return _dense != nullptr;}
+    static void setCompactPercent(int percent);
+    static int getCompactPercent() {return _compactPercent.load(std::memory_order_relaxed);}
     void updateSize(DNode* node);
     void updateNumVacant(DNode* node);
     bool checkImbalance(DNode* node); 
@@ -151,17 +297,46 @@ public:
 
 private:
     DNode* _root;
+    DenseIndex* _dense; // when set, every node lives in here and _root is nullptr
+    NodePool* _pool; // where the nodes come from, shared with the UTree when there is one
+    bool _ownPool; // true if the pool was made by this DTree and only holds its nodes
+    const char* _username; // shared by every node, set by the first insert unless the UNode lends its key
+    bool _ownUsername; // true if _username was allocated out of the pool by this DTree
+    static std::atomic<int> _compactPercent; // see setCompactPercent
     /* IMPLEMENT (optional): any additional helper functions here */
-    void removeTraverse(int disc, DNode* node, DNode*& removed); // traverses through the list to the desired Discriminator
+    bool removeAccount(int disc, Account* removed); // remove, handing the account out first when removed is set
+    void removeTraverse(int disc, DNode*& node, DNode*& removed, DNode**& compact); // traverses through the list to the desired Discriminator, removed is set to the node left vacant
+    void compactSubtree(DNode** link, int disc); // drops the vacant nodes of the subtree hanging off link, disc must lead there from the root
+    bool overVacant(const DNode* node) const; // checks if vacant nodes make up more of the subtree than the compaction threshold allows
+    void reviveNode(DNode* node, const AccountRef& account); // refills a vacant node with a new account
+    bool accepts(const AccountRef& account) const; // checks an account could belong to this DTree, ignoring taken discriminators
+    NodePool* pool(); // returns the node pool, making one for a DTree that has none
+    DNode* makeNode(const AccountRef& account); // allocates a DNode out of the pool
+    DNode* copyNode(const DNode* source); // allocates a DNode with the same account as source
+    const char* copyStatus(const char* status, int length); // copies a status into the pool
+    void freeNode(DNode* node); // gives a DNode back to the pool
     void assignmentRoot(DNode* rhsRoot); // assigns new root and calls recursive assignment
     void assignmentTraverse(DNode* prev, DNode* node, DNode* rhsNode, bool leftRight); // recursive assignment
-    int validTraverse(DNode* node) const; // recursive helper for getNumUsers
     DNode* retrieveTraverse(int disc, DNode* node); // recursive helper for retrieval
     void printTraverse(DNode* node) const; // recursive helper for printAccounts
     void clearTraverse(DNode* node); // recursive helper for clear(), called by ~DTree
-    int countTraverse(DNode* node); // recursive helper for getNumUsers
     bool rebalanceTraverse(DNode* node); // honestly i dont remember what this is for, i dont think i used it but im too scared that the code might break if i delete it lmao
-    void insertTraverse(Account newAcct, DNode* node); // recursive helper for insert
-    void sortTraverse(DNode ** array, DNode* node, int * count); // recursive helper to sort nodes into an array
-    DNode* rebalanceTraverse(DNode ** nodes, int end); // recursive helper for rebalance
+    void insertTraverse(const AccountRef& account, DNode*& node, DNode*& inserted, DNode**& scapegoat); // recursive helper for insert
+    void insertBatchTraverse(DNode*& node, const AccountRef* accounts, bool* results, int count, int& inserted); // recursive helper for insertBatch
+    void removeBatchTraverse(DNode*& node, const int* discs, bool* results, int count, int& removed); // recursive helper for removeBatch
+    void rebuildSubtree(DNode** link, int disc); // rebalances the subtree hanging off link, disc must lead there from the root
+    void toDense(); // moves every node of the tree into a new dense index
+    void toTree(); // builds a balanced tree back out of the dense index
+    int denseVine(DNode*& vine); // empties the dense index into a sorted vine
+    void denseTraverse(DNode* node); // recursive helper for toDense
+    int lowestFreeTraverse(DNode* node, int lo) const; // recursive helper for findFree
+    int nthFreeTraverse(DNode* node, int lo, int n) const; // recursive helper for findFree
+    void rangeTraverse(DNode* node, int lo, int hi, const std::function<void(DNode*)>& callback) const; // recursive helper for forEachInRange
+    int vineTraverse(DNode* node, DNode*& vine); // flattens a subtree into a sorted vine, dropping vacant nodes
+    DNode* buildTraverse(DNode*& vine, int count); // recursive helper for rebalance, builds a balanced subtree off the vine
+    void saveRecords(SnapshotWriter& writer) const; // appends a record for every DNode to a snapshot
+    void saveTraverse(const DNode* node, SnapshotWriter& writer) const; // recursive helper for saveRecords
+    bool restoreRecords(SnapshotReader& reader, uint32_t count, bool dense); // rebuilds an empty DTree from its snapshot records
+    DNode* restoreTraverse(SnapshotReader& reader, size_t end, bool& ok); // recursive helper for restoreRecords
+    DNode* restoreNode(SnapshotReader& reader); // makes a DNode out of the next record, nullptr if it is corrupt
 };
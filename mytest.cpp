@@ -1,6 +1,15 @@
 #include "utree.h"
+#include "cutree.h"
+#include "version.h"
+#include "shard.h"
+#include "cursor.h"
+#include <map>
 #include <random>
 #include <string>
+#include <cstdlib>
+#include <cstdio>
+#include <chrono>
+#include <climits>
 
 #define NUMACCTS 20
 #define RANDDISC (distAcct(rng))
@@ -8,6 +17,17 @@
 std::mt19937 rng(10);
 std::uniform_int_distribution<> distAcct(0, 9999);
 
+// counts every heap allocation so tests can check that a code path makes none, loads allocate from several threads
+std::atomic<long> numAllocations(0);
+void* operator new(size_t bytes) {
+    numAllocations++;
+    void* block = std::malloc(bytes ? bytes : 1);
+    if (!block) throw std::bad_alloc();
+    return block;
+}
+void operator delete(void* block) noexcept {std::free(block);}
+void operator delete(void* block, size_t) noexcept {std::free(block);}
+
 class Tester {
 public:
     bool testBasicDTreeInsert(DTree& dtree);
@@ -19,7 +39,19 @@ public:
     void dtreeInsertPerformance(int numTrials, int N);
     bool dtreeInsertRetrieve(DTree &dtree);
     bool rebalanceTest();
+    bool dtreeRebalanceInPlace();
+    bool dtreeScapegoatBalance();
+    bool dtreeDenseIndex();
+    bool dtreeRankSelect();
+    bool dtreeRangeQueries();
+    bool dtreeCompactAccounts();
+    bool dtreeVacancy();
+    bool dtreeNoImbalance(DTree& dtree, DNode* node, int& height);
     bool dtreeGetNumUsers();
+    bool dtreeSizeBookkeeping();
+    bool dtreeInsertReturnsNode();
+    bool dtreeCheckCounts(DNode* node, int& size, int& numVacant);
+    bool badgeTableFull();
 
     // notes:
     // test for a username used twice?
@@ -31,7 +63,31 @@ public:
     bool utreeInsert(UTree& utree);
     bool utreeEmptyRemove();
     bool utreeRemoveUser(UTree & tree, string username, int disc);
+    bool utreeRemoveLastAccount();
     void utreeInsertPerformance(int numTrials, int N);
+    void utreeLoadScaling(int numLines, int maxThreads);
+    bool utreeInsertDuplicate();
+    bool utreeAllocateDiscriminator();
+    bool nodePoolReuse();
+    bool utreeClearReleasesPool();
+    bool utreeInlineKeys();
+    bool utreeZeroCopyLookup();
+    bool utreeEmplace();
+    bool utreeBulkLoad();
+    bool utreeLoadReport();
+    bool utreeParallelLoad();
+    bool utreeSnapshot();
+    bool utreeOpLog();
+    bool utreeConcurrent();
+    bool utreeVersioned();
+    bool utreeSharded();
+    bool utreeBatch();
+    bool utreeCursor();
+    template <class Node> bool versionCheckAVL(const Node* node, int& height, int& size);
+    void copyFile(string from, string to);
+    bool utreeSameAccounts(UTree& expected, UTree& actual, const std::vector<string>& names);
+    void writeAccounts(string dataFile, int numLines, int numNames, std::mt19937& fileRng);
+    bool utreeCheckAVL(UNode* node, int& height);
     
     
 };
@@ -40,8 +96,7 @@ public:
 
 bool Tester::utreeEmptyRemove(){
     UTree utree;
-    DNode * removed = nullptr;
-    if (!utree.removeUser("username", RANDDISC, removed)) return true;
+    if (!utree.removeUser("username", RANDDISC)) return true;
     return false;
 }
 
@@ -55,6 +110,84 @@ bool Tester::dtreeGetNumUsers(){
     return false;
 }
 
+bool Tester::dtreeCheckCounts(DNode* node, int& size, int& numVacant){
+    // recounts a subtree from scratch and compares it against the stored counts
+    size = 0;
+    numVacant = 0;
+    if (!node) return true;
+
+    int leftSize, leftVacant, rightSize, rightVacant;
+    if (!dtreeCheckCounts(node->_left, leftSize, leftVacant)) return false;
+    if (!dtreeCheckCounts(node->_right, rightSize, rightVacant)) return false;
+
+    size = 1 + leftSize + rightSize;
+    numVacant = (node->isVacant() ? 1 : 0) + leftVacant + rightVacant;
+    return node->getSize() == size && node->getNumVacant() == numVacant;
+}
+
+bool Tester::badgeTableFull(){
+    // the table is shared by the whole process, so only the badges that still fit get in
+    UTree utree;
+    int room = MAX_BADGES - BadgeTable::count();
+    int inserted = 0;
+    for (int i = 0; i < room + 10; i++) inserted += utree.emplace("badges", MIN_DISC + i, false, "badge" + std::to_string(i), "");
+    if (inserted != room || BadgeTable::count() != MAX_BADGES) return false;
+
+    // once it is full, a new badge fails just its own insert, everywhere, and the old badges keep working
+    if (utree.emplace("newname", MIN_DISC, false, "one too many", "") || utree.retrieve("newname")) return false;
+    if (!utree.emplace("newname", MIN_DISC, false, "badge0", "") || utree.retrieveUser("newname", MIN_DISC)->getBadge() != "badge0") return false;
+    std::vector<Account> accounts = {Account("batch", MIN_DISC, false, "one too many", ""), Account("batch", MIN_DISC + 1, false, "", "")};
+    std::vector<bool> results;
+    if (utree.insertBatch(accounts.data(), accounts.size(), results) != 1 || results[0] || !results[1]) return false;
+    ConcurrentUTree shared;
+    VersionedUTree versioned;
+    DTree dtree;
+    if (shared.emplace("x", MIN_DISC, false, "one too many", "") || versioned.emplace("x", MIN_DISC, false, "one too many", "")) return false;
+    if (dtree.insert(Account("x", MIN_DISC, false, "one too many", "")) || dtree.getNumUsers() != 0) return false;
+    if (!dtree.insert(Account("x", MIN_DISC, false, "", ""))) return false;
+
+    // a load reports the line with the new badge and loads the rest, with one thread or more
+    string dataFile = "badges.csv";
+    std::ofstream out(dataFile);
+    out << "loaded,1,0,badge1,\n" << "refused,2,0,one too many,\n" << "loaded,3,0,,\n";
+    out.close();
+    bool loaded = true;
+    for (int numThreads : {1, 2}){
+        UTree fromFile;
+        LoadReport report = fromFile.loadData(dataFile, true, numThreads);
+        if (report.loaded != 2 || report.errors.size() != 1 || report.errors[0].line != 2 || fromFile.retrieve("refused")) loaded = false;
+    }
+    std::remove(dataFile.c_str());
+    return loaded;
+}
+
+bool Tester::dtreeSizeBookkeeping(){
+    DTree dtree;
+    int size, numVacant;
+    for (int i = 0; i < 500; i++){
+        dtree.insert(Account("nino", RANDDISC, false, "", ""));
+        if (i % 3 == 0){
+            dtree.remove(RANDDISC);
+        }
+        if (!dtreeCheckCounts(dtree._root, size, numVacant)) return false;
+    }
+    if (dtree.getNumUsers() != size - numVacant) return false;
+    return true;
+}
+
+bool Tester::dtreeInsertReturnsNode(){
+    DTree dtree;
+    DNode * inserted = nullptr;
+    for (int i = 0; i < 100; i++){
+        int disc = RANDDISC;
+        bool taken = dtree.retrieve(disc) != nullptr;
+        if (dtree.insert(Account("nino", disc, false, "", ""), inserted) == taken) return false;
+        if (taken && inserted) return false; // duplicates should not hand back a node
+        if (!taken && (!inserted || inserted != dtree.retrieve(disc))) return false;
+    }
+    return true;
+}
+
 bool Tester::rebalanceTest(){
     DTree dtree;
     int accounts = 5;
@@ -66,6 +199,249 @@ bool Tester::rebalanceTest(){
     return false;
 }
 
+bool Tester::dtreeRebalanceInPlace(){
+    DTree dtree;
+    for (int i = 0; i < 300; i++){
+        dtree.insert(Account("nino", RANDDISC, false, "", ""));
+    }
+    for (int i = 0; i < 300; i++){
+        dtree.remove(RANDDISC);
+    }
+    int users = dtree.getNumUsers();
+
+    // a rebuild keeps every node that is still in use and nothing else
+    DNode * rebuilt = dtree.rebalance(dtree._root);
+    dtree._root = rebuilt;
+    int size, numVacant;
+    if (!dtreeCheckCounts(dtree._root, size, numVacant)) return false;
+    if (numVacant != 0 || size != users) return false;
+
+    // every subtree of a freshly rebuilt tree differs in size by at most one
+    DNode * node = dtree._root;
+    while (node){
+        int leftSize = node->_left ? node->_left->getSize() : 0;
+        int rightSize = node->_right ? node->_right->getSize() : 0;
+        if (rightSize - leftSize < 0 || rightSize - leftSize > 1) return false;
+        node = node->_right;
+    }
+    return true;
+}
+
+bool Tester::dtreeNoImbalance(DTree& dtree, DNode* node, int& height){
+    height = 0;
+    if (!node) return true;
+
+    int leftHeight, rightHeight;
+    if (dtree.checkImbalance(node)) return false;
+    if (!dtreeNoImbalance(dtree, node->_left, leftHeight)) return false;
+    if (!dtreeNoImbalance(dtree, node->_right, rightHeight)) return false;
+    height = (leftHeight > rightHeight ? leftHeight : rightHeight) + 1;
+    return true;
+}
+
+bool Tester::dtreeScapegoatBalance(){
+    // ascending discriminators used to build a chain nobody ever rebalanced
+    // stays under DENSE_THRESHOLD so the trees keep their shape
+    DTree sorted;
+    for (int i = 0; i < DENSE_THRESHOLD - 1; i++){
+        sorted.insert(Account("nino", i, false, "", ""));
+    }
+    DTree random;
+    for (int i = 0; i < DENSE_THRESHOLD - 1; i++){
+        random.insert(Account("nino", RANDDISC, false, "", ""));
+    }
+
+    // with only inserts every node keeps the Discord rule, so the height stays logarithmic
+    int height;
+    if (!dtreeNoImbalance(sorted, sorted._root, height) || height > 30) return false;
+    if (!dtreeNoImbalance(random, random._root, height) || height > 30) return false;
+    return true;
+}
+
+bool Tester::dtreeDenseIndex(){
+    DTree dtree;
+    int users = DENSE_THRESHOLD + 500;
+    for (int i = 0; i < users; i++){
+        dtree.insert(Account("nino", i * 3, false, "", ""));
+    }
+    if (!dtree.isDense() || dtree._root || dtree.getNumUsers() != users) return false;
+    if (dtree.insert(Account("nino", 3, false, "", ""))) return false; // taken
+    if (dtree.retrieve(4) || !dtree.retrieve(3) || dtree.retrieve(3)->getDiscriminator() != 3) return false;
+    if (dtree.getUsername() != "nino") return false;
+
+    DTree copy;
+    copy = dtree;
+    if (!copy.isDense() || copy.getNumUsers() != users || copy.retrieve(30) == dtree.retrieve(30)) return false;
+
+    // removing most of the users goes back to a balanced tree with the survivors
+    for (int i = 0; i < users - 100; i++){
+        if (!dtree.remove(i * 3)) return false;
+    }
+    if (dtree.isDense() || dtree.getNumUsers() != 100) return false;
+    for (int i = users - 100; i < users; i++){
+        if (!dtree.retrieve(i * 3)) return false;
+    }
+    int size, numVacant, height;
+    if (!dtreeCheckCounts(dtree._root, size, numVacant) || size - numVacant != 100) return false;
+    return dtreeNoImbalance(dtree, dtree._root, height);
+}
+
+bool Tester::dtreeRankSelect(){
+    std::mt19937 rankRng(341); // own generator so the other tests see the same random sequence
+    std::uniform_int_distribution<> discs(MIN_DISC, MAX_DISC);
+    DTree dtree;
+    for (int round = 0; round < 2; round++){
+        // the first round stays a tree with vacant nodes, the second one goes dense
+        int inserts = round == 0 ? 600 : 3000;
+        for (int i = 0; i < inserts; i++){
+            dtree.insert(Account("nino", discs(rankRng), false, "", ""));
+            if (i % 4 == 0) dtree.remove(discs(rankRng));
+        }
+        if (dtree.isDense() != (round == 1)) return false;
+
+        // every user's rank is its position and selecting that position gets it back
+        int users = dtree.getNumUsers();
+        int k = 0;
+        for (int disc = MIN_DISC; disc <= MAX_DISC; disc++){
+            DNode * node = dtree.retrieve(disc);
+            if (dtree.rank(disc) != k) return false;
+            if (!node || node->isVacant()) continue;
+            if (dtree.select(k) != node) return false;
+            k++;
+        }
+        if (k != users || dtree.select(users) || dtree.rank(MAX_DISC + 1) != users) return false;
+
+        DNode * sample = dtree.sampleRandom(rankRng);
+        if (!sample || sample->isVacant() || dtree.retrieve(sample->getDiscriminator()) != sample) return false;
+    }
+    DTree empty;
+    return !empty.sampleRandom(rankRng) && !empty.select(0) && empty.rank(MAX_DISC) == 0;
+}
+
+bool Tester::dtreeRangeQueries(){
+    std::mt19937 rangeRng(341); // own generator so the other tests see the same random sequence
+    std::uniform_int_distribution<> discs(MIN_DISC, MAX_DISC);
+    DTree dtree;
+    for (int round = 0; round < 2; round++){
+        // the first round stays a tree with vacant nodes, the second one goes dense
+        int inserts = round == 0 ? 600 : 3000;
+        for (int i = 0; i < inserts; i++){
+            dtree.insert(Account("nino", discs(rangeRng), false, "", ""));
+            if (i % 4 == 0) dtree.remove(discs(rangeRng));
+        }
+
+        for (int i = 0; i < 20; i++){
+            int lo = discs(rangeRng) - 100;
+            int hi = lo + discs(rangeRng) / 4;
+            int expected = 0;
+            for (int disc = lo; disc <= hi; disc++){
+                DNode * node = dtree.retrieve(disc);
+                if (node && !node->isVacant()) expected++;
+            }
+
+            // the visits come back in order, inside the range and match the count
+            int visited = 0;
+            int last = lo - 1;
+            bool ordered = true;
+            dtree.forEachInRange(lo, hi, [&](DNode * node){
+                if (node->isVacant() || node->getDiscriminator() <= last || node->getDiscriminator() > hi) ordered = false;
+                last = node->getDiscriminator();
+                visited++;
+            });
+            if (!ordered || visited != expected || dtree.countRange(lo, hi) != expected) return false;
+        }
+    }
+    // bounds past either end of the discriminators count up to that end
+    int users = dtree.getNumUsers();
+    if (dtree.countRange(MIN_DISC, INT_MAX) != users || dtree.countRange(INT_MIN, MAX_DISC) != users) return false;
+    if (dtree.countRange(INT_MIN, INT_MAX) != users || dtree.countRange(MAX_DISC + 1, INT_MAX) != 0) return false;
+    if (dtree.countRange(INT_MIN, MIN_DISC - 1) != 0) return false;
+    return dtree.countRange(10, 5) == 0;
+}
+
+bool Tester::dtreeVacancy(){
+    // with compaction off, a removed account leaves a vacant node that nothing but the counts can see
+    DTree::setCompactPercent(100);
+    DTree dtree;
+    for (int disc = 0; disc < 100; disc++) dtree.insert(Account("nino", disc, false, "", "first"));
+    DNode * node = dtree.retrieveTraverse(40, dtree._root);
+    if (!dtree.remove(40) || dtree.remove(40) || dtree.retrieve(40)) return false;
+    std::mt19937 freeRng(341);
+    if (dtree.findFree(LOWEST_FREE, freeRng) != 40) return false;
+    for (int i = 0; i < 200; i++){
+        if (dtree.retrieve(dtree.findFree(RANDOM_FREE, freeRng))) return false;
+    }
+
+    // inserting the discriminator again fills the vacant node in place, with the new account
+    if (!dtree.insert(Account("nino", 40, true, "Subscriber", "second")) || dtree.retrieve(40) != node) return false;
+    if (node->getStatus() != "second" || !node->hasNitro() || dtree.getNumUsers() != 100) return false;
+    int size, numVacant;
+    if (!dtreeCheckCounts(dtree._root, size, numVacant) || size != 100 || numVacant != 0) return false;
+
+    // a batch revives the same way
+    int discs[] = {10, 20, 30};
+    bool results[3];
+    dtree.removeBatch(discs, 3, results);
+    AccountRef again[] = {AccountRef("nino", 10, false, "", "batch"), AccountRef("nino", 10, false, "", "repeat"),
+                          AccountRef("nino", 20, false, "", "batch")};
+    if (dtree.insertBatch(again, 3, results) != 2 || !results[0] || results[1] || !results[2]) return false;
+    if (dtree.retrieve(10)->getStatus() != "batch" || dtree.retrieve(30)) return false;
+    if (!dtreeCheckCounts(dtree._root, size, numVacant) || size != 100 || numVacant != 1) return false;
+
+    // past the threshold, removals compact the tree as they go and it stays balanced
+    DTree::setCompactPercent(COMPACT_PERCENT);
+    DTree shrinking;
+    for (int disc = 0; disc < 1000; disc++) shrinking.insert(Account("nino", disc, false, "", ""));
+    std::vector<int> order(1000);
+    for (int i = 0; i < 1000; i++) order[i] = i;
+    std::shuffle(order.begin(), order.end(), freeRng);
+    int height;
+    for (int i = 0; i < 900; i++){
+        if (!shrinking.remove(order[i])) return false;
+        if (!dtreeCheckCounts(shrinking._root, size, numVacant) || numVacant * 100 > size * COMPACT_PERCENT) return false;
+    }
+    if (shrinking.getNumUsers() != 100 || !dtreeNoImbalance(shrinking, shrinking._root, height)) return false;
+
+    // at 0 nothing vacant is ever kept, and the account still comes back from the node that was freed
+    DTree::setCompactPercent(0);
+    for (int i = 900; i < 990; i++){
+        Account gone;
+        if (!shrinking.remove(order[i], gone) || shrinking._root->_numVacant != 0) return false;
+        if (gone.getUsername() != "nino" || gone.getDiscriminator() != order[i]) return false;
+        if (shrinking.remove(order[i], gone) || gone.getDiscriminator() != order[i]) return false;
+    }
+    DTree::setCompactPercent(COMPACT_PERCENT);
+    return shrinking.getNumUsers() == 10 && shrinking._root->_size == 10;
+}
+
+bool Tester::dtreeCompactAccounts(){
+    // a node has to be a fraction of the size of the account it holds
+    if (sizeof(DNode) * 2 > sizeof(Account)) return false;
+
+    DTree dtree;
+    string status(300, 's'); // long enough to need its own block in the pool
+    dtree.insert(Account("nino", 1, true, "Subscriber", status));
+    dtree.insert(Account("nino", 2, false, "Subscriber", ""));
+    dtree.insert(Account("nino", 3, false, "", "proj2 :100:"));
+    if (dtree.insert(Account("someone else", 4, false, "", ""))) return false; // a DTree only holds one username
+
+    DNode * one = dtree.retrieve(1);
+    DNode * two = dtree.retrieve(2);
+    if (one->_badge != two->_badge || one->_username != two->_username) return false;
+
+    Account acct = one->getAccount();
+    if (acct.getUsername() != "nino" || acct.getDiscriminator() != 1 || !acct.hasNitro()) return false;
+    if (acct.getBadge() != "Subscriber" || acct.getStatus() != status) return false;
+    if (dtree.retrieve(3)->getStatus() != "proj2 :100:" || dtree.retrieve(3)->getBadge() != "") return false;
+
+    // a copy gets its own username and statuses
+    DTree copy;
+    copy = dtree;
+    dtree.clear();
+    if (copy.getUsername() != "nino" || copy.retrieve(1)->getStatus() != status) return false;
+    return copy.retrieve(2)->getBadge() == "Subscriber";
+}
+
 bool Tester::dtreeInsertRetrieve(DTree &dtree){
     int disc = RANDDISC;
     dtree.insert(Account("nino", disc, true, "", ""));
@@ -120,9 +496,9 @@ bool Tester::testBasicDTreeInsert(DTree& dtree) {
 }
 
 bool Tester::dtreeRemove(DTree& dtree){
-    dtree.insert(Account("nino", 1234, true, "",""));
-    DNode* bruh = nullptr;
-    if (dtree.remove(1234, bruh)) return true;
+    dtree.insert(Account("nino", 1234, true, "","bruh"));
+    Account bruh;
+    if (dtree.remove(1234, bruh) && bruh.getDiscriminator() == 1234 && bruh.getStatus() == "bruh") return true;
     return false;
 }
 
@@ -134,8 +510,7 @@ bool Tester::dtreeInsertRemoveRebalance(DTree& dtree){
         }
         dtree.insert(Account(username, disc, false, "", "")); //this is the node were gonna work with
 
-        DNode * removed = nullptr;
-        dtree.remove(disc, removed);
+        dtree.remove(disc);
 
         for (int i = 0; i < 10; i++){
             dtree.insert(Account(username, 9000 + i, false, "", "")); // populate tree
@@ -179,25 +554,1113 @@ bool Tester::utreeInsert(UTree & tree){
 
 }
 
+bool Tester::utreeCheckAVL(UNode* node, int& height){
+    height = -1;
+    if (!node) return true;
+
+    int leftHeight, rightHeight;
+    if (!utreeCheckAVL(node->_left, leftHeight)) return false;
+    if (!utreeCheckAVL(node->_right, rightHeight)) return false;
+    if (node->_left && node->_left->getUsername() >= node->getUsername()) return false;
+    if (node->_right && node->_right->getUsername() <= node->getUsername()) return false;
+
+    height = (leftHeight > rightHeight ? leftHeight : rightHeight) + 1;
+    if (leftHeight - rightHeight > 1 || rightHeight - leftHeight > 1) return false;
+    return node->getHeight() == height;
+}
+
+bool Tester::utreeInsertDuplicate(){
+    UTree utree;
+    for (int i = 0; i < 200; i++){
+        // alternating ends of the alphabet forces both single and double rotations
+        string username = (i % 2) ? "a" + std::to_string(1000 - i) : "z" + std::to_string(i);
+        if (!utree.insert(Account(username, 1234, false, "", ""))) return false;
+    }
+    if (utree.insert(Account("z0", 1234, false, "", ""))) return false; // same username and disc
+    if (!utree.insert(Account("z0", 4321, false, "", ""))) return false;
+
+    int height;
+    return utreeCheckAVL(utree._root, height);
+}
+
+bool Tester::utreeAllocateDiscriminator(){
+    UTree utree;
+    std::mt19937 allocRng(341); // own generator so the other tests see the same random sequence
+    Account acct = Account("nino", 0, false, "", "");
+    for (int i = 0; i < 10; i++){
+        if (i != 5) utree.insert(Account("nino", i, false, "", ""));
+    }
+    if (utree.allocateDiscriminator(acct, LOWEST_FREE, allocRng) != 5) return false;
+    if (utree.allocateDiscriminator(acct, LOWEST_FREE, allocRng) != 10) return false;
+    if (utree.allocateDiscriminator(Account("new", 0, false, "", ""), LOWEST_FREE, allocRng) != MIN_DISC) return false;
+
+    // random picks in a sparse tree, then in a nearly full one that has switched to the dense index
+    for (int i = 0; i < 50; i++){
+        int disc = utree.allocateDiscriminator(acct, RANDOM_FREE, allocRng);
+        if (disc == INVALID_DISC || utree.retrieveUser("nino", disc)->getDiscriminator() != disc) return false;
+    }
+    for (int disc = MIN_DISC; disc <= MAX_DISC - 20; disc++){
+        utree.insert(Account("nino", disc, false, "", ""));
+    }
+    while (utree.retrieve("nino")->getDTree()->getNumUsers() < NUM_DISCS){
+        int users = utree.retrieve("nino")->getDTree()->getNumUsers();
+        if (utree.allocateDiscriminator(acct, RANDOM_FREE, allocRng) == INVALID_DISC) return false;
+        if (utree.retrieve("nino")->getDTree()->getNumUsers() != users + 1) return false;
+    }
+    return utree.allocateDiscriminator(acct, LOWEST_FREE, allocRng) == INVALID_DISC;
+}
+
+bool Tester::nodePoolReuse(){
+    NodePool pool;
+    void * blocks[100];
+    for (int i = 0; i < 100; i++) blocks[i] = pool.allocate(sizeof(DNode));
+    int chunks = pool.getNumChunks();
+
+    // released blocks come back before the pool carves out new ones
+    for (int i = 0; i < 100; i++) pool.release(blocks[i], sizeof(DNode));
+    for (int i = 0; i < 100; i++){
+        void * block = pool.allocate(sizeof(DNode));
+        if (block != blocks[99 - i]) return false;
+    }
+    if (pool.getNumChunks() != chunks) return false;
+
+    void * large = pool.allocate(sizeof(DenseIndex));
+    pool.release(large, sizeof(DenseIndex));
+    pool.clear();
+    return pool.getNumChunks() == 0 && !pool._large;
+}
+
+bool Tester::utreeClearReleasesPool(){
+    UTree utree;
+    for (int i = 0; i < 2000; i++){
+        utree.insert(Account(std::to_string(i % 300), i, false, "", ""));
+    }
+    if (utree._pool.getNumChunks() == 0) return false;
+
+    utree.clear();
+    if (utree._root || utree._pool.getNumChunks() != 0) return false;
+
+    // the tree is still usable after clearing it
+    if (!utree.insert(Account("nino", 1234, false, "", ""))) return false;
+    return utree.retrieveUser("nino", 1234) != nullptr;
+}
+
+bool Tester::utreeInlineKeys(){
+    UTree utree;
+    string shortName = "nino";
+    string longName(100, 'n');
+    utree.insert(Account(shortName, 1, false, "", ""));
+    utree.insert(Account(longName, 2, false, "", ""));
+
+    // short keys live inside the UNode, and its DTree and DNodes share the same copy
+    UNode * shortNode = utree.retrieve(shortName);
+    UNode * longNode = utree.retrieve(longName);
+    if (!shortNode || shortNode->_key != shortNode->_inlineKey) return false;
+    if (!longNode || longNode->_key == longNode->_inlineKey) return false;
+    if (shortNode->getDTree()->_username != shortNode->_key) return false;
+    if (utree.retrieveUser(shortName, 1)->_username != shortNode->_key) return false;
+    if (longNode->getUsername() != longName || utree.retrieveUser(longName, 2)->getUsername() != longName) return false;
+
+    if (!utree.removeUser(longName, 2)) return false;
+    return utree.retrieveUser(shortName, 1)->getAccount().getUsername() == shortName;
+}
+
+bool Tester::utreeZeroCopyLookup(){
+    UTree utree;
+    string longName(100, 'n');
+    for (int i = 0; i < 100; i++){
+        utree.insert(Account("user" + std::to_string(i), i, i % 2, "Subscriber", "status " + std::to_string(i)));
+    }
+    utree.insert(Account(longName, 42, true, "Subscriber", "a status long enough to not fit in a small string"));
+
+    // looking accounts up and reading them back should not touch the heap at all
+    long before = numAllocations;
+    size_t total = 0;
+    for (int i = 0; i < 100; i++){
+        std::string_view username = (i % 2) ? std::string_view("user7") : std::string_view("user42");
+        DNode * node = utree.retrieveUser(username, (i % 2) ? 7 : 42);
+        if (!node) return false;
+        total += node->getUsername().size() + node->getBadge().size() + node->getStatus().size();
+    }
+    DNode * node = utree.retrieveUser(longName, 42);
+    if (!node || node->getStatus().size() < 16 || node->getUsername() != longName) return false;
+    if (utree.numUsers("user3") != 1 || utree.retrieve("missing")) return false;
+    if (numAllocations != before) return false;
+
+    return total > 0;
+}
+
+bool Tester::utreeEmplace(){
+    UTree utree;
+    string longName(100, 'e');
+    string longStatus(64, 's');
+    if (!utree.emplace("emma", 1234, true, "Subscriber", longStatus)) return false;
+    if (utree.emplace("emma", 1234, false, "", "")) return false; // discriminator already taken
+    if (utree.emplace("emma", MAX_DISC + 1, false, "", "")) return false;
+    if (utree.emplace("nobody", MIN_DISC - 1, false, "", "")) return false;
+    if (utree.retrieve("nobody")) return false; // a rejected account should not leave an empty username behind
+    string tooLong(MAX_STATUS_LENGTH + 1, 's'); // turned down by the DTree, after the UNode is made
+    if (utree.emplace("bob", 1, false, "", tooLong) || utree.retrieve("bob")) return false;
+    if (utree.insert(Account("bob", 1, false, "", tooLong)) || utree.retrieve("bob")) return false;
+    std::mt19937 emplaceRng(341);
+    if (utree.allocateDiscriminator(Account("bob", 0, false, "", tooLong), LOWEST_FREE, emplaceRng) != INVALID_DISC || utree.retrieve("bob")) return false;
+    ShardedUTree sharded;
+    if (sharded.emplace("bob", 1, false, "", tooLong) || sharded.numUsers("bob") != 0) return false;
+    for (int s = 0; s < sharded.getNumShards(); s++){
+        if (sharded._shards[s].tree.retrieve("bob")) return false;
+    }
+
+    // emplacing copies the fields straight into the pool, the only heap traffic left is the pool growing
+    long before = numAllocations;
+    for (int i = 0; i < 100; i++){
+        if (!utree.emplace("emma", i, i % 2, "Subscriber", longStatus)) return false;
+    }
+    if (!utree.emplace(longName, 42, true, "Subscriber", longStatus)) return false;
+    long emplaceAllocations = numAllocations - before;
+
+    UTree copies;
+    before = numAllocations;
+    for (int i = 0; i < 100; i++){
+        if (!copies.insert(Account("emma", i, i % 2, "Subscriber", longStatus))) return false;
+    }
+    if (!copies.insert(Account(longName, 42, true, "Subscriber", longStatus))) return false;
+    long insertAllocations = numAllocations - before;
+    if (emplaceAllocations >= 10 || emplaceAllocations >= insertAllocations) return false;
+
+    // the fields should read back exactly as they went in
+    DNode * node = utree.retrieveUser("emma", 1234);
+    if (!node || !node->hasNitro() || node->getBadge() != "Subscriber" || node->getStatus() != longStatus) return false;
+    node = utree.retrieveUser(longName, 42);
+    if (!node || node->getUsername() != longName) return false;
+
+    // insert and emplace should land in the same place
+    DTree dtree;
+    if (!dtree.insert(Account("emma", 7, false, "", "status")) || dtree.emplace("emma", 7, true, "", "")) return false;
+    if (!dtree.emplace("emma", 8, true, "", "status") || dtree.getNumUsers() != 2) return false;
+    return utree.numUsers("emma") == 101;
+}
+
+bool Tester::utreeBulkLoad(){
+    std::mt19937 bulkRng(341);
+    std::uniform_int_distribution<> nameDist(0, 199);
+    std::uniform_int_distribution<> discDist(0, 99);
+    std::vector<string> names;
+    for (int i = 0; i < 200; i++) names.push_back("user" + std::to_string(i));
+    string longName(120, 'l'); // the accounts only borrow their fields, so these have to outlive the load
+
+    // the same accounts, repeats included, loaded one at a time and all at once
+    UTree inserted, bulk;
+    std::vector<AccountRef> accounts;
+    for (int i = 0; i < 3000; i++){
+        const string& name = names[nameDist(bulkRng)];
+        int disc = discDist(bulkRng);
+        inserted.emplace(name, disc, i % 2, "", "");
+        accounts.emplace_back(name, disc, i % 2, "", "");
+    }
+    accounts.emplace_back("bad", MAX_DISC + 1, false, "", ""); // rejected, and should not leave a UNode behind
+    accounts.emplace_back(longName, 7, false, "", "");
+    for (int disc = MIN_DISC; disc < MIN_DISC + DENSE_THRESHOLD + 10; disc++){
+        accounts.emplace_back("dense", disc, false, "", "");
+    }
+    int expected = 0;
+    for (const string& name : names) expected += inserted.numUsers(name);
+    if (bulk.bulkLoad(accounts) != expected + 1 + DENSE_THRESHOLD + 10) return false;
+
+    int height;
+    if (!utreeCheckAVL(bulk._root, height) || bulk.retrieve("bad") || bulk.numUsers(longName) != 1) return false;
+    for (const string& name : names){
+        if (bulk.numUsers(name) != inserted.numUsers(name)) return false;
+        for (int disc = 0; disc < 100; disc++){
+            DNode * expect = inserted.retrieveUser(name, disc);
+            DNode * node = bulk.retrieveUser(name, disc);
+            if (!expect != !node) return false;
+            if (node && node->hasNitro() != expect->hasNitro()) return false; // the first of a repeat wins
+        }
+        UNode * unode = bulk.retrieve(name);
+        int size, numVacant;
+        if (unode && !dtreeCheckCounts(unode->getDTree()->_root, size, numVacant)) return false;
+    }
+    if (!bulk.retrieve("dense")->getDTree()->isDense()) return false;
+
+    // appending merges into the trees that are already there, existing accounts win
+    std::vector<AccountRef> more;
+    for (int disc = 0; disc < 200; disc++){
+        more.emplace_back("user0", disc, true, "", "");
+        more.emplace_back("zzz", disc, true, "", "");
+    }
+    int before = bulk.numUsers("user0");
+    if (bulk.bulkLoad(more) != 200 - before + 200) return false;
+    if (bulk.numUsers("user0") != 200 || bulk.numUsers("zzz") != 200) return false;
+    if (!utreeCheckAVL(bulk._root, height)) return false;
+    DNode * node = bulk.retrieveUser("user0", discDist(bulkRng));
+    int size, numVacant;
+    return node && dtreeCheckCounts(bulk.retrieve("user0")->getDTree()->_root, size, numVacant);
+}
+
 bool Tester::utreeRemoveUser(UTree & tree, string username, int disc){
-    DNode * useless = nullptr;
+    Account useless;
     
-    if (tree.removeUser(username, disc, useless)) return true;
+    if (tree.removeUser(username, disc, useless) && useless.getUsername() == username) return true;
     else return false;
 }
 
+bool Tester::utreeRemoveLastAccount(){
+    std::mt19937 lastRng(24);
+    std::vector<string> names;
+    UTree utree;
+    for (int i = 0; i < 200; i++){
+        names.push_back("user" + std::to_string(i));
+        utree.emplace(names.back(), MIN_DISC, false, "", "");
+        utree.emplace(names.back(), MIN_DISC + 1, false, "", "");
+    }
+
+    // a username stays while it has an account, and goes with its last one wherever it is in the tree
+    std::shuffle(names.begin(), names.end(), lastRng);
+    int height;
+    for (size_t i = 0; i < names.size(); i++){
+        if (!utree.removeUser(names[i], MIN_DISC) || !utree.retrieve(names[i])) return false;
+        if (!utree.removeUser(names[i], MIN_DISC + 1) || utree.retrieve(names[i])) return false;
+        if (utree.removeUser(names[i], MIN_DISC + 1)) return false;
+        if (i % 20 == 0 && !utreeCheckAVL(utree._root, height)) return false;
+    }
+    if (utree._root) return false;
+
+    // the same for a batch, and for the trees shared between threads
+    std::vector<std::pair<std::string_view, int>> users;
+    std::vector<bool> results;
+    for (int i = 0; i < 50; i++) utree.emplace(names[i], MIN_DISC, false, "", "");
+    for (int i = 0; i < 50; i += 2) users.push_back({names[i], MIN_DISC});
+    if (utree.removeBatch(users.data(), users.size(), results) != 25) return false;
+    for (int i = 0; i < 50; i++){
+        if (bool(utree.retrieve(names[i])) != bool(i % 2)) return false;
+    }
+    if (!utreeCheckAVL(utree._root, height)) return false;
+
+    ConcurrentUTree shared;
+    shared.emplace("solo", MIN_DISC, false, "", "");
+    if (!shared.removeUser("solo", MIN_DISC) || shared._tree.retrieve("solo")) return false;
+    ShardedUTree sharded;
+    sharded.emplace("solo", MIN_DISC, false, "", "");
+    if (!sharded.removeUser("solo", MIN_DISC)) return false;
+    for (int s = 0; s < sharded.getNumShards(); s++){
+        if (sharded._shards[s].tree._root) return false;
+    }
+    return true;
+}
+
 bool Tester::testBasicUTreeInsert(UTree& utree) {
     string dataFile = "accounts.csv";
-    try {
-        utree.loadData(dataFile);
+    LoadReport report = utree.loadData(dataFile);
+    for (const LoadError& error : report.errors){
+        std::cerr << dataFile << ":" << error.line << ": " << error.reason << endl;
+    }
+    return report.ok();
+}
 
-    } catch(std::invalid_argument &e) {
-        std::cerr << e.what() << endl;
-        return false;
+bool Tester::utreeLoadReport(){
+    string dataFile = "loadreport.csv";
+    std::ofstream out(dataFile);
+    out << "alpha,1,1,Subscriber,hello, world\n"   // 1: too many fields
+        << "alpha,12x,0,,\n"                      // 2: bad discriminator
+        << "\n"                                   // 3: blank, skipped
+        << "alpha,10000,0,,\n"                    // 4: out of range
+        << "beta,7,0,,windows line\r\n"            // 5: fine, the carriage return is dropped
+        << "alpha,42,yes,,\n"                     // 6: bad nitro
+        << "alpha,42,1,Subscriber,status\n"       // 7: fine
+        << "alpha,42,0,,taken\n"                  // 8: parses, but 42 is already taken
+        << "gamma,+5,0,,no newline at the end";   // 9: fine
+    out.close();
+
+    UTree utree;
+    LoadReport report = utree.loadData(dataFile);
+    std::remove(dataFile.c_str());
+    if (report.ok() || !report.opened) return false;
+    if (report.lines != 9 || report.parsed != 4 || report.loaded != 3) return false;
+    if (report.errors.size() != 4) return false;
+    int expected[] = {1, 2, 4, 6};
+    for (int i = 0; i < 4; i++) if (report.errors[i].line != expected[i]) return false;
+
+    DNode * node = utree.retrieveUser("beta", 7);
+    if (!node || node->getStatus() != "windows line") return false;
+    node = utree.retrieveUser("alpha", 42);
+    if (!node || !node->hasNitro() || utree.numUsers("alpha") != 1) return false;
+    if (!utree.retrieveUser("gamma", 5)) return false;
+
+    // a missing file is reported rather than ending the program, and leaves the tree alone
+    report = utree.loadData("missing.csv", false);
+    if (report.opened || report.ok() || report.errors.size() != 1 || report.errors[0].line != 0) return false;
+    return utree.numUsers("beta") == 1;
+}
+
+
+void Tester::writeAccounts(string dataFile, int numLines, int numNames, std::mt19937& fileRng){
+    std::uniform_int_distribution<> nameDist(0, numNames - 1);
+    std::uniform_int_distribution<> discDist(0, 9999);
+    std::ofstream out(dataFile);
+    for (int i = 0; i < numLines; i++){
+        out << "user" << nameDist(fileRng) << "," << discDist(fileRng) << "," << (i % 2) << ",Subscriber,status " << i << "\n";
+    }
+}
+
+bool Tester::utreeParallelLoad(){
+    std::mt19937 fileRng(341);
+    string dataFile = "parallel.csv";
+    writeAccounts(dataFile, 20000, 500, fileRng);
+    {
+        std::ofstream out(dataFile, std::ios::app);
+        out << "broken line\n" << "user1,99999,0,,\n" << "user2,7,0,,last line without a newline";
+    }
+
+    // every thread count should end up with the same accounts and the same report
+    UTree serial;
+    LoadReport expected = serial.loadData(dataFile, true, 1);
+    if (expected.errors.size() != 2 || expected.errors[0].line != 20001 || expected.errors[1].line != 20002) return false;
+    for (int numThreads : {2, 3, 8}){
+        UTree parallel;
+        LoadReport report = parallel.loadData(dataFile, true, numThreads);
+        if (report.lines != expected.lines || report.parsed != expected.parsed || report.loaded != expected.loaded) return false;
+        if (report.errors.size() != expected.errors.size()) return false;
+        for (size_t i = 0; i < report.errors.size(); i++) if (report.errors[i].line != expected.errors[i].line) return false;
+
+        int height;
+        if (!utreeCheckAVL(parallel._root, height)) return false;
+        for (int i = 0; i < 500; i++){
+            string name = "user" + std::to_string(i);
+            if (parallel.numUsers(name) != serial.numUsers(name)) return false;
+        }
+        DNode * node = parallel.retrieveUser("user2", 7);
+        DNode * expect = serial.retrieveUser("user2", 7);
+        if (!node || !expect || node->getStatus() != expect->getStatus()) return false; // the first of a repeat wins either way
+    }
+
+    // appending in parallel merges into the trees that are already there
+    UTree utree;
+    for (int disc = 0; disc < 50; disc++) utree.emplace("user3", disc, true, "", "kept");
+    utree.emplace("aaa", 1, true, "", "");
+    LoadReport report = utree.loadData(dataFile, true, 4);
+    std::remove(dataFile.c_str());
+    int added = 0; // what the file adds to user3 on top of the 50 it already had
+    for (int disc = 50; disc <= MAX_DISC; disc++) if (serial.retrieveUser("user3", disc)) added++;
+    if (utree.numUsers("user3") != 50 + added) return false;
+    if (report.loaded != expected.loaded - serial.numUsers("user3") + added) return false;
+    if (!utree.retrieveUser("aaa", 1) || utree.retrieveUser("user3", 10)->getStatus() != "kept") return false;
+    int height;
+    return utreeCheckAVL(utree._root, height) && utree.numUsers("user4") == serial.numUsers("user4");
+}
+
+bool Tester::utreeSameAccounts(UTree& expected, UTree& actual, const std::vector<string>& names){
+    for (const string& name : names){
+        if (expected.numUsers(name) != actual.numUsers(name)) return false;
+        UNode * unode = expected.retrieve(name);
+        if (!unode) continue;
+        bool same = true;
+        unode->getDTree()->forEachInRange(MIN_DISC, MAX_DISC, [&](DNode * node){
+            DNode * copy = actual.retrieveUser(name, node->getDiscriminator());
+            if (node->isVacant()) return; // a removed account may or may not still have a node
+            if (!copy || copy->isVacant() || copy->getUsername() != node->getUsername() || copy->hasNitro() != node->hasNitro() ||
+                copy->getBadge() != node->getBadge() || copy->getStatus() != node->getStatus()) same = false;
+        });
+        if (!same || expected.retrieve(name)->getDTree()->isDense() != actual.retrieve(name)->getDTree()->isDense()) return false;
     }
     return true;
 }
 
+bool Tester::utreeSnapshot(){
+    std::mt19937 snapRng(341);
+    std::uniform_int_distribution<> nameDist(0, 299);
+    std::uniform_int_distribution<> discDist(MIN_DISC, MAX_DISC);
+    std::vector<string> names;
+    for (int i = 0; i < 300; i++) names.push_back((i % 7 ? "user" : string(40, 'l')) + std::to_string(i));
+    string badges[] = {"", "Subscriber", "Hypesquad", "Moderator"};
+
+    UTree utree;
+    for (int i = 0; i < 5000; i++){
+        string status = (i % 3) ? "status " + string(i % 60, 's') : "";
+        utree.emplace(names[nameDist(snapRng)], discDist(snapRng), i % 2, badges[i % 4], status);
+    }
+    for (int disc = MIN_DISC; disc < MIN_DISC + DENSE_THRESHOLD; disc++) utree.emplace("dense", disc, true, "Moderator", "hi");
+    for (int i = 0; i < 500; i++){ // leaves vacant nodes behind
+        utree.removeUser(names[nameDist(snapRng)], discDist(snapRng));
+    }
+    names.push_back("dense");
+    string longName(300, 'n'), longStatus(300, 's'); // past POOL_MAX_CLASS, so heap blocks of their own once released
+    for (int disc = MIN_DISC; disc < MIN_DISC + 2; disc++){
+        utree.emplace(longName, disc, false, "", longStatus);
+        utree.emplace("longstatus", disc, false, "", longStatus);
+    }
+    names.push_back(longName);
+    names.push_back("longstatus");
+
+    string path = "snapshot.bin";
+    if (!utree.saveSnapshot(path)) return false;
+    UTree restored;
+    restored.emplace("gone", 1, false, "", ""); // whatever was there before is replaced
+    if (!restored.loadSnapshot(path) || restored.retrieve("gone")) return false;
+
+    int height;
+    if (!utreeCheckAVL(restored._root, height) || !utreeSameAccounts(utree, restored, names)) return false;
+    for (const string& name : names){
+        UNode * unode = restored.retrieve(name);
+        int size, numVacant;
+        if (unode && !dtreeCheckCounts(unode->getDTree()->_root, size, numVacant)) return false;
+    }
+
+    // long strings that came out of the snapshot can be released, by a revival and by the UNode going
+    for (UTree* tree : {&utree, &restored}){
+        if (!tree->removeUser("longstatus", MIN_DISC) || !tree->emplace("longstatus", MIN_DISC, false, "", "revived")) return false;
+        if (!tree->removeUser(longName, MIN_DISC) || !tree->removeUser(longName, MIN_DISC + 1) || tree->retrieve(longName)) return false;
+    }
+    if (!utreeSameAccounts(utree, restored, names)) return false;
+
+    // the restored trees should take inserts and removals like any other, their strings live in the pool now
+    for (int i = 0; i < 2000; i++){
+        const string& name = names[nameDist(snapRng)];
+        int disc = discDist(snapRng);
+        restored.removeUser(name, disc);
+        utree.removeUser(name, disc);
+        restored.emplace(name, disc + 1 > MAX_DISC ? MIN_DISC : disc + 1, true, "Subscriber", string(i % 80, 'x'));
+        utree.emplace(name, disc + 1 > MAX_DISC ? MIN_DISC : disc + 1, true, "Subscriber", string(i % 80, 'x'));
+    }
+    if (!utreeSameAccounts(utree, restored, names)) return false;
+
+    // a corrupted or missing snapshot is refused and leaves the tree alone
+    {
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(200);
+        file.put('\x7f');
+    }
+    bool corrupt = restored.loadSnapshot(path);
+    std::remove(path.c_str());
+    if (corrupt || restored.loadSnapshot("missing.bin")) return false;
+    if (!utreeSameAccounts(utree, restored, names)) return false;
+
+    // an empty tree round trips as well
+    UTree empty;
+    if (!empty.saveSnapshot(path) || !restored.loadSnapshot(path)) return false;
+    std::remove(path.c_str());
+    return restored._root == nullptr;
+}
+
+void Tester::copyFile(string from, string to){
+    std::ifstream in(from, std::ios::binary);
+    std::ofstream out(to, std::ios::binary | std::ios::trunc);
+    out << in.rdbuf();
+}
+
+bool Tester::utreeOpLog(){
+    std::mt19937 logRng(341);
+    std::uniform_int_distribution<> nameDist(0, 49);
+    std::uniform_int_distribution<> discDist(MIN_DISC, MIN_DISC + 99);
+    std::vector<string> names;
+    for (int i = 0; i < 50; i++) names.push_back("user" + std::to_string(i));
+    string snapshot = "oplog.snap", log = "oplog.log", crashSnapshot = "crash.snap", crashLog = "crash.log";
+    for (const string& path : {snapshot, log, crashSnapshot, crashLog}) std::remove(path.c_str());
+
+    // everything a crash leaves on disk should come back, syncEvery 1 means nothing is lost
+    UTree utree;
+    if (!utree.openLog(snapshot, log)) return false;
+    auto churn = [&](int count){
+        for (int i = 0; i < count; i++){
+            const string& name = names[nameDist(logRng)];
+            if (i % 4 == 3) utree.removeUser(name, discDist(logRng));
+            else if (i % 4 == 2) utree.allocateDiscriminator(Account(name, 0, true, "Subscriber", ""), RANDOM_FREE, logRng);
+            else utree.emplace(name, discDist(logRng), i % 2, "Subscriber", "status " + std::to_string(i));
+        }
+    };
+    churn(400);
+    copyFile(snapshot, crashSnapshot);
+    copyFile(log, crashLog);
+    {
+        UTree recovered;
+        if (!recovered.openLog(crashSnapshot, crashLog) || !utreeSameAccounts(utree, recovered, names)) return false;
+        if (recovered._sequence != utree._sequence) return false;
+    }
+
+    // a checkpoint empties the log, and later changes are replayed on top of it
+    string beforeCheckpoint = "before.log";
+    copyFile(log, beforeCheckpoint);
+    if (!utree.checkpoint()) return false;
+    std::ifstream truncated(log, std::ios::binary | std::ios::ate);
+    if (truncated.tellg() != 0) return false;
+    churn(200);
+    copyFile(snapshot, crashSnapshot);
+    copyFile(log, crashLog);
+    {
+        UTree recovered;
+        if (!recovered.openLog(crashSnapshot, crashLog) || !utreeSameAccounts(utree, recovered, names)) return false;
+    }
+
+    // a crash after the snapshot went in but before the log was cut leaves records the snapshot already has
+    copyFile(snapshot, crashSnapshot);
+    copyFile(beforeCheckpoint, crashLog);
+    {
+        std::ofstream out(crashLog, std::ios::binary | std::ios::app);
+        std::ifstream in(log, std::ios::binary);
+        out << in.rdbuf();
+    }
+    {
+        UTree recovered;
+        if (!recovered.openLog(crashSnapshot, crashLog) || !utreeSameAccounts(utree, recovered, names)) return false;
+        if (recovered._sequence != utree._sequence) return false;
+    }
+
+    // a record torn by a crash is dropped, and the log carries on after the last good one
+    copyFile(log, crashLog);
+    {
+        std::ofstream out(crashLog, std::ios::binary | std::ios::app);
+        out << "\x40\x00\x00\x00torn";
+    }
+    {
+        UTree recovered;
+        if (!recovered.openLog(crashSnapshot, crashLog) || !utreeSameAccounts(utree, recovered, names)) return false;
+        recovered.emplace("after", 5, false, "", "torn tail");
+        recovered.closeLog();
+        UTree again;
+        if (!again.openLog(crashSnapshot, crashLog) || !again.retrieveUser("after", 5)) return false;
+        if (!utreeSameAccounts(utree, again, names)) return false;
+    }
+
+    // a log whose snapshot never made it to disk is replayed from its very first record
+    string lostSnapshot = "lost.snap", lostLog = "lost.log";
+    for (const string& path : {lostSnapshot, lostLog}) std::remove(path.c_str());
+    {
+        UTree first;
+        if (!first.openLog(lostSnapshot, lostLog)) return false;
+        first.emplace("first", 1, false, "", "");
+        first.emplace("second", 2, false, "", "");
+        first.closeLog();
+        std::remove(lostSnapshot.c_str());
+        UTree recovered;
+        bool replayed = recovered.openLog(lostSnapshot, lostLog) && recovered.retrieveUser("first", 1) && recovered.retrieveUser("second", 2);
+        recovered.closeLog();
+        for (const string& path : {lostSnapshot, lostLog}) std::remove(path.c_str());
+        if (!replayed) return false;
+    }
+
+    // batching: syncEvery 10 syncs once per 10 changes, 0 only when asked
+    utree.closeLog();
+    UTree batched;
+    if (!batched.openLog(snapshot, log, 10)) return false;
+    uint64_t syncs = batched._log.getNumSyncs();
+    for (int i = 0; i < 100; i++) batched.emplace("batched", i, false, "", "");
+    if (batched._log.getNumSyncs() - syncs != 10) return false;
+    batched.closeLog();
+    if (!batched.openLog(snapshot, log, 0)) return false;
+    syncs = batched._log.getNumSyncs();
+    for (int i = 100; i < 200; i++) batched.emplace("batched", i, false, "", "");
+    if (batched._log.getNumSyncs() != syncs || !batched.syncLog() || batched._log.getNumSyncs() != syncs + 1) return false;
+    batched.clear();
+    batched.emplace("cleared", 1, false, "", "");
+    batched.closeLog();
+    {
+        UTree recovered;
+        if (!recovered.openLog(snapshot, log) || recovered.numUsers("batched") != 0 || !recovered.retrieveUser("cleared", 1)) return false;
+    }
+
+    for (const string& path : {snapshot, log, crashSnapshot, crashLog, beforeCheckpoint}) std::remove(path.c_str());
+    return true;
+}
+
+bool Tester::utreeConcurrent(){
+    const int numThreads = 8, numNames = 40, discsPerThread = 50;
+    std::vector<string> names;
+    for (int i = 0; i < numNames; i++) names.push_back((i % 5 ? "user" : string(40, 'c')) + std::to_string(i));
+    string snapshot = "concurrent.snap", log = "concurrent.log";
+    for (const string& path : {snapshot, log}) std::remove(path.c_str());
+
+    // every thread owns its own discriminators of every username, so it knows exactly which of them exist
+    ConcurrentUTree tree;
+    if (!tree.openLog(snapshot, log)) return false;
+    std::vector<std::vector<char>> expected(numThreads, std::vector<char>(numNames * discsPerThread, 0));
+    std::atomic<bool> failed(false);
+    UTree::runParallel(numThreads, [&](int t){
+        std::mt19937 threadRng(341 + t);
+        std::uniform_int_distribution<> nameDist(0, numNames - 1), slotDist(0, discsPerThread - 1), opDist(0, 9);
+        std::vector<char>& mine = expected[t];
+        for (int i = 0; i < 2000; i++){
+            int name = nameDist(threadRng), slot = slotDist(threadRng);
+            int disc = MIN_DISC + slot * numThreads + t;
+            char& present = mine[name * discsPerThread + slot];
+            int op = opDist(threadRng);
+            if (op < 4){
+                // a vacant node left by a removal is revived, so only an account that is there is turned down
+                string status = "t" + std::to_string(t) + " d" + std::to_string(disc);
+                bool inserted = tree.emplace(names[name], disc, false, "Subscriber", status);
+                if (inserted == bool(present)) failed = true;
+                present = 1;
+            }else if (op < 7){
+                if (tree.removeUser(names[name], disc) != bool(present)) failed = true;
+                present = 0;
+            }else{
+                Account found;
+                bool exists = tree.retrieveUser(names[name], disc, found);
+                if (exists != bool(present)) failed = true;
+                if (exists && found.getStatus() != "t" + std::to_string(t) + " d" + std::to_string(disc)) failed = true;
+                tree.numUsers(names[(name + 1) % numNames]); // someone else's DTree, busy or not
+            }
+        }
+    });
+    if (failed) return false;
+
+    int height;
+    if (!utreeCheckAVL(tree._tree._root, height)) return false;
+    for (int name = 0; name < numNames; name++){
+        int count = 0;
+        for (int t = 0; t < numThreads; t++){
+            for (int slot = 0; slot < discsPerThread; slot++){
+                bool present = expected[t][name * discsPerThread + slot];
+                count += present;
+                if (tree.hasUser(names[name], MIN_DISC + slot * numThreads + t) != present) return false;
+            }
+        }
+        if (tree.numUsers(names[name]) != count) return false;
+    }
+
+    // threads racing to allocate under one username never get the same discriminator
+    std::vector<std::vector<int>> allocated(numThreads);
+    UTree::runParallel(numThreads, [&](int t){
+        std::mt19937 threadRng(341 + t);
+        for (int i = 0; i < 100; i++){
+            Account account("allocated", 0, false, "", "");
+            allocated[t].push_back(tree.allocateDiscriminator(account, i % 2 ? LOWEST_FREE : RANDOM_FREE, threadRng));
+        }
+    });
+    std::vector<char> taken(MAX_DISC + 1, 0);
+    for (const std::vector<int>& discs : allocated){
+        for (int disc : discs){
+            if (disc == INVALID_DISC || taken[disc]) return false;
+            taken[disc] = 1;
+        }
+    }
+    if (tree.numUsers("allocated") != numThreads * 100) return false;
+
+    // the log holds every change no matter which thread made it
+    names.push_back("allocated");
+    tree.closeLog();
+    UTree recovered;
+    if (!recovered.openLog(snapshot, log) || !utreeSameAccounts(tree._tree, recovered, names)) return false;
+    recovered.closeLog();
+
+    for (const string& path : {snapshot, log}) std::remove(path.c_str());
+    return true;
+}
+
+template <class Node>
+bool Tester::versionCheckAVL(const Node* node, int& height, int& size){
+    height = -1;
+    size = 0;
+    if (!node) return true;
+
+    int leftHeight, rightHeight, leftSize, rightSize;
+    if (!versionCheckAVL(node->left, leftHeight, leftSize) || !versionCheckAVL(node->right, rightHeight, rightSize)) return false;
+    height = std::max(leftHeight, rightHeight) + 1;
+    size = leftSize + rightSize + 1;
+    if (leftHeight - rightHeight > 1 || rightHeight - leftHeight > 1) return false;
+    return node->height == height;
+}
+
+bool Tester::utreeVersioned(){
+    typedef std::map<string, std::map<int, string>> Model;
+    std::mt19937 versionRng(341);
+    std::uniform_int_distribution<> nameDist(0, 99), discDist(MIN_DISC, MIN_DISC + 199);
+    std::vector<string> names;
+    for (int i = 0; i < 100; i++) names.push_back((i % 6 ? "user" : string(40, 'v')) + std::to_string(i));
+
+    // every write has to agree with a plain map of what should be there
+    VersionedUTree versioned;
+    Model model;
+    bool agreed = true;
+    auto churn = [&](int count){
+        for (int i = 0; i < count; i++){
+            const string& name = names[nameDist(versionRng)];
+            int disc = discDist(versionRng);
+            bool present = model.count(name) && model[name].count(disc);
+            if (i % 3 == 2){
+                if (versioned.removeUser(name, disc) != present) agreed = false;
+                if (present && model[name].erase(disc) && model[name].empty()) model.erase(name);
+            }else{
+                string status = "status " + std::to_string(i);
+                if (versioned.emplace(name, disc, i % 2, i % 4 ? "Subscriber" : "", status) == present) agreed = false;
+                if (!present) model[name][disc] = status;
+            }
+        }
+    };
+    auto matches = [&](const Version& version, const Model& expected){
+        Model seen;
+        version.forEach([&](const AccountRef& account){seen[string(account.username)][account.disc] = string(account.status);});
+        if (seen != expected) return false;
+        for (const auto& user : expected){
+            if (version.numUsers(user.first) != int(user.second.size())) return false;
+        }
+        int height, size;
+        std::function<bool(const VUNode*)> accountsBalanced = [&](const VUNode* node){
+            if (!node) return true;
+            return versionCheckAVL(node->accounts, height, size) && size == node->numUsers &&
+                   accountsBalanced(node->left) && accountsBalanced(node->right);
+        };
+        return accountsBalanced(version._root) && versionCheckAVL(version._root, height, size) && size == int(expected.size());
+    };
+    churn(3000);
+    if (!agreed || !matches(versioned.current(), model)) return false;
+
+    // a version taken before a run of writes does not see any of them
+    Model frozenModel = model;
+    {
+        Version frozen = versioned.current();
+        uint64_t reclaimed = versioned._numReclaimed;
+        churn(3000);
+        if (!agreed || !matches(frozen, frozenModel) || !matches(versioned.current(), model)) return false;
+        // the frozen version keeps the epoch from moving on more than once, so hardly anything got freed
+        if (versioned._numReclaimed - reclaimed > VERSION_RECLAIM_BATCH * 2) return false;
+
+        // and it can be backed up while the writes go on, into a snapshot a UTree restores
+        if (!frozen.saveSnapshot("versioned.snap")) return false;
+        UTree restored;
+        if (!restored.loadSnapshot("versioned.snap")) return false;
+        for (const auto& user : frozenModel){
+            if (restored.numUsers(user.first) != int(user.second.size())) return false;
+            for (const auto& account : user.second){
+                DNode * node = restored.retrieveUser(user.first, account.first);
+                if (!node || node->getStatus() != account.second) return false;
+            }
+        }
+        std::remove("versioned.snap");
+    }
+
+    // once it is let go, what only it could reach gets freed
+    uint64_t reclaimed = versioned._numReclaimed;
+    churn(3000);
+    if (!agreed || versioned._numReclaimed == reclaimed) return false;
+
+    // a write copies its path and nothing else
+    const string& name = model.begin()->first;
+    uint64_t retired = versioned._retired[0].size() + versioned._retired[1].size() + versioned._numReclaimed;
+    int disc = MIN_DISC + 500;
+    if (!versioned.emplace(name, disc, false, "", "")) return false;
+    uint64_t copied = versioned._retired[0].size() + versioned._retired[1].size() + versioned._numReclaimed - retired;
+    if (copied == 0 || copied > 30) return false;
+
+    // readers running alongside a writer always see a whole version, never a write halfway through
+    versioned.clear();
+    std::atomic<bool> writing(true), consistent(true);
+    UTree::runParallel(4, [&](int t){
+        if (t == 0){
+            for (int i = 0; i < 2000; i++){
+                string seq = std::to_string(100000 + i);
+                versioned.emplace(seq, 1, false, "", "");
+                versioned.emplace("churn", i % 50, false, "", "churn"); // old versions pile up for reclaiming
+                versioned.removeUser("churn", (i + 25) % 50);
+            }
+            writing = false;
+            return;
+        }
+        while (writing){
+            Version version = versioned.current();
+            int count = 0;
+            version.forEach([&](const AccountRef& account){if (account.username != "churn") count++;});
+            if (count > 0 && !version.retrieve(std::to_string(100000 + count - 1), 1)) consistent = false;
+            if (version.retrieve(std::to_string(100000 + count), 1)) consistent = false;
+        }
+    });
+    if (!consistent || versioned.numUsers(std::to_string(100000 + 1999)) != 1) return false;
+    return true;
+}
+
+bool Tester::utreeSharded(){
+    std::mt19937 shardRng(341);
+    std::uniform_int_distribution<> nameDist(0, 199), discDist(MIN_DISC, MIN_DISC + 49), opDist(0, 2);
+    std::vector<string> names;
+    for (int i = 0; i < 200; i++) names.push_back((i % 9 ? "user" : string(40, 's')) + std::to_string(i));
+
+    // every username lives in exactly one shard, and the shards between them hold everything
+    ShardedUTree sharded(8);
+    std::vector<ShardOp> ops;
+    std::vector<string> statuses;
+    statuses.reserve(4000); // the ops keep views of these
+    for (int i = 0; i < 4000; i++){
+        statuses.push_back("status " + std::to_string(i));
+        ShardOpType type = static_cast<ShardOpType>(opDist(shardRng));
+        ops.push_back({type, AccountRef(names[nameDist(shardRng)], discDist(shardRng), i % 2, "Subscriber", statuses.back()), false});
+    }
+    for (ShardOp& op : ops){
+        if (op.type == SHARD_INSERT) op.done = sharded.emplace(op.account.username, op.account.disc, op.account.nitro, op.account.badge, op.account.status);
+        else if (op.type == SHARD_REMOVE) op.done = sharded.removeUser(op.account.username, op.account.disc);
+        else op.done = sharded.hasUser(op.account.username, op.account.disc);
+    }
+    int usedShards = 0;
+    for (int s = 0; s < sharded.getNumShards(); s++) usedShards += sharded._shards[s].tree._root != nullptr;
+    if (usedShards < sharded.getNumShards() / 2) return false;
+    for (const string& name : names){
+        int holding = 0;
+        for (int s = 0; s < sharded.getNumShards(); s++) holding += sharded._shards[s].tree.retrieve(name) != nullptr;
+        if (holding > 1) return false;
+    }
+
+    // a batch spread over threads does the same as running its operations one at a time
+    ShardedUTree batched(8);
+    std::vector<ShardOp> batch = ops;
+    for (ShardOp& op : batch) op.done = false;
+    int done = batched.applyBatch(batch, 4);
+    int expectedDone = 0;
+    for (size_t i = 0; i < ops.size(); i++){
+        if (batch[i].done != ops[i].done) return false;
+        expectedDone += ops[i].done;
+    }
+    if (done != expectedDone) return false;
+    for (const string& name : names){
+        if (batched.numUsers(name) != sharded.numUsers(name)) return false;
+        for (int disc = MIN_DISC; disc < MIN_DISC + 50; disc++){
+            Account expected, found;
+            bool exists = sharded.retrieveUser(name, disc, expected);
+            if (batched.retrieveUser(name, disc, found) != exists) return false;
+            if (exists && found.getStatus() != expected.getStatus()) return false;
+        }
+    }
+
+    // writers of different usernames run side by side, each shard's pool only ever sees one of them at a time
+    ShardedUTree parallel;
+    UTree::runParallel(8, [&](int t){
+        std::mt19937 threadRng(341 + t);
+        for (int i = 0; i < 500; i++){
+            string name = "thread" + std::to_string(t) + "_" + std::to_string(i % 100);
+            parallel.emplace(name, MIN_DISC + 100 + i / 100, false, "", "");
+            Account found;
+            parallel.retrieveUser(names[i % 200], MIN_DISC, found);
+            if (i % 5 == 4) parallel.allocateDiscriminator(Account(name, 0, false, "", ""), LOWEST_FREE, threadRng);
+        }
+    });
+    for (int t = 0; t < 8; t++){
+        for (int i = 0; i < 100; i++){
+            if (parallel.numUsers("thread" + std::to_string(t) + "_" + std::to_string(i)) != (i % 5 == 4 ? 10 : 5)) return false;
+        }
+    }
+
+    // a bulk load goes to every shard at once
+    std::vector<AccountRef> accounts;
+    for (const string& name : names){
+        for (int disc = MIN_DISC; disc < MIN_DISC + 20; disc++) accounts.push_back(AccountRef(name, disc, false, "", "bulk"));
+    }
+    std::shuffle(accounts.begin(), accounts.end(), shardRng);
+    ShardedUTree loaded(8);
+    if (loaded.bulkLoad(accounts, 4) != int(accounts.size())) return false;
+    for (const string& name : names){
+        if (loaded.numUsers(name) != 20) return false;
+    }
+    return true;
+}
+
+bool Tester::utreeBatch(){
+    std::mt19937 batchRng(341);
+    std::uniform_int_distribution<> nameDist(0, 149), discDist(MIN_DISC, MIN_DISC + 99);
+    std::vector<string> names;
+    for (int i = 0; i < 150; i++) names.push_back((i % 7 ? "user" : string(40, 'b')) + std::to_string(i));
+    names.push_back("dense");
+
+    // both trees start out the same, with some vacant nodes, and only the first 100 usernames
+    UTree single, batched;
+    for (int i = 0; i < 1500; i++){
+        const string& name = names[nameDist(batchRng) % 100];
+        int disc = discDist(batchRng);
+        if (i % 5 == 4){
+            single.removeUser(name, disc);
+            batched.removeUser(name, disc);
+        }else{
+            single.emplace(name, disc, false, "", "before");
+            batched.emplace(name, disc, false, "", "before");
+        }
+    }
+
+    // a batch inserts the same accounts as inserting them one at a time, repeats and bad accounts included
+    std::vector<Account> accounts;
+    for (int i = 0; i < 3000; i++) accounts.push_back(Account(names[nameDist(batchRng)], discDist(batchRng), i % 2, "Subscriber", "batch " + std::to_string(i)));
+    for (int disc = MIN_DISC; disc < MIN_DISC + 1500; disc++) accounts.push_back(Account("dense", disc, false, "", "")); // goes dense
+    accounts.push_back(Account());
+    accounts.push_back(Account("toolong", 1, false, "", string(MAX_STATUS_LENGTH + 1, 's')));
+    std::shuffle(accounts.begin(), accounts.end(), batchRng);
+    std::vector<bool> results;
+    int inserted = batched.insertBatch(accounts.data(), accounts.size(), results);
+    int expectedInserted = 0;
+    for (size_t i = 0; i < accounts.size(); i++){
+        bool expected = single.insert(accounts[i]);
+        if (results[i] != expected) return false;
+        expectedInserted += expected;
+    }
+    if (inserted != expectedInserted || batched.retrieve("toolong") || !batched.retrieve("dense")->getDTree()->isDense()) return false;
+    int height;
+    if (!utreeCheckAVL(batched._root, height) || !utreeSameAccounts(single, batched, names)) return false;
+
+    // a batch removes the same users as removing them one at a time, removing a vacant node does nothing
+    std::vector<std::pair<std::string_view, int>> users;
+    for (int i = 0; i < 3000; i++) users.push_back({names[nameDist(batchRng)], discDist(batchRng)});
+    for (int disc = MIN_DISC; disc < MIN_DISC + 1400; disc++) users.push_back({"dense", disc}); // goes back to a tree
+    users.push_back({"nobody", 1});
+    std::shuffle(users.begin(), users.end(), batchRng);
+    int removedCount = batched.removeBatch(users.data(), users.size(), results);
+    int expectedRemoved = 0;
+    for (size_t i = 0; i < users.size(); i++){
+        DNode * user = single.retrieveUser(users[i].first, users[i].second);
+        bool expected = user && !user->isVacant() && single.removeUser(users[i].first, users[i].second);
+        if (results[i] != expected) return false;
+        expectedRemoved += expected;
+    }
+    if (removedCount != expectedRemoved || batched.retrieve("dense")->getDTree()->isDense()) return false;
+    if (!utreeCheckAVL(batched._root, height) || !utreeSameAccounts(single, batched, names)) return false;
+    for (const string& name : names){
+        UNode * unode = batched.retrieve(name);
+        int size, numVacant;
+        if (unode && !dtreeCheckCounts(unode->getDTree()->_root, size, numVacant)) return false;
+    }
+
+    // a tree only ever changed by batches has no imbalance left anywhere once a batch is done
+    UTree fresh;
+    fresh.insertBatch(accounts.data(), accounts.size() / 2, results);
+    fresh.insertBatch(accounts.data() + accounts.size() / 3, accounts.size() - accounts.size() / 3, results);
+    if (!utreeCheckAVL(fresh._root, height)) return false;
+    for (const string& name : names){
+        UNode * unode = fresh.retrieve(name);
+        if (unode && !dtreeNoImbalance(*unode->getDTree(), unode->getDTree()->_root, height)) return false;
+    }
+
+    // every change of a batch is logged, and replaying the log gives the same accounts
+    string snapshot = "batch.snap", log = "batch.log";
+    for (const string& path : {snapshot, log}) std::remove(path.c_str());
+    {
+        UTree logged;
+        if (!logged.openLog(snapshot, log)) return false;
+        logged.insertBatch(accounts.data(), accounts.size(), results);
+        logged.removeBatch(users.data(), users.size(), results);
+        logged.closeLog();
+        UTree recovered;
+        if (!recovered.openLog(snapshot, log) || !utreeSameAccounts(logged, recovered, names)) return false;
+        recovered.closeLog();
+    }
+    for (const string& path : {snapshot, log}) std::remove(path.c_str());
+    return true;
+}
+
+bool Tester::utreeCursor(){
+    std::mt19937 cursorRng(341);
+    std::uniform_int_distribution<> nameDist(0, 99), discDist(MIN_DISC, MIN_DISC + 199);
+    std::vector<string> names;
+    for (int i = 0; i < 100; i++) names.push_back((i % 7 ? "user" : string(40, 'k')) + std::to_string(i));
+    names.push_back("dense");
+    names.push_back("with:colon");
+
+    // an empty tree has nothing to walk
+    UTree utree;
+    Cursor empty(utree);
+    if (empty.next() || empty.current()) return false;
+
+    // what the tree should hold, vacant nodes and a dense DTree included
+    std::map<std::pair<string, int>, string> expected;
+    for (int i = 0; i < 4000; i++){
+        const string& name = names[nameDist(cursorRng)];
+        int disc = discDist(cursorRng);
+        if (i % 4 == 3){
+            DNode * user = utree.retrieveUser(name, disc);
+            if (user && !user->isVacant() && utree.removeUser(name, disc)) expected.erase({name, disc});
+        }else if (utree.emplace(name, disc, false, "", "status " + std::to_string(i))){
+            expected[{name, disc}] = "status " + std::to_string(i);
+        }
+    }
+    for (int disc = MIN_DISC; disc < MIN_DISC + 1500; disc += 1){
+        utree.emplace("dense", disc, false, "", "");
+        expected[{"dense", disc}] = "";
+    }
+    utree.emplace("with:colon", 7, false, "", "");
+    expected[{"with:colon", 7}] = "";
+    if (!utree.retrieve("dense")->getDTree()->isDense()) return false;
+
+    // one walk sees every account in order, and nothing else
+    Cursor cursor(utree);
+    auto it = expected.begin();
+    while (cursor.next()){
+        const DNode * node = cursor.current();
+        if (it == expected.end() || node->isVacant() || node->getUsername() != it->first.first ||
+            node->getDiscriminator() != it->first.second || node->getStatus() != it->second) return false;
+        ++it;
+    }
+    if (it != expected.end() || cursor.current() || cursor.next()) return false;
+
+    // paging with a fresh cursor per page, resumed from the token the last page left, sees the same
+    std::vector<Account> pages;
+    string token = Cursor(utree).save();
+    while (true){
+        Cursor page(utree);
+        if (!page.resume(token)) return false;
+        if (page.fetch(37, pages) == 0) break;
+        token = page.save();
+    }
+    if (pages.size() != expected.size()) return false;
+    it = expected.begin();
+    for (const Account& account : pages){
+        if (account.getUsername() != it->first.first || account.getDiscriminator() != it->first.second) return false;
+        ++it;
+    }
+
+    // a token outlives changes to the tree, whatever changed before the position is not seen
+    Cursor middle(utree);
+    if (!middle.resume("100:" + names[50])) return false;
+    if (!middle.next()) return false;
+    token = middle.save();
+    std::pair<string, int> position(string(middle.current()->getUsername()), middle.current()->getDiscriminator());
+    utree.emplace("a", 1, false, "", "");
+    utree.emplace("zzzz", 1, false, "", "");
+    auto after = expected.upper_bound(position);
+    utree.removeUser(after->first.first, after->first.second);
+    Cursor resumed(utree);
+    if (!resumed.resume(token) || !resumed.next()) return false;
+    ++after;
+    if (resumed.current()->getUsername() != after->first.first || resumed.current()->getDiscriminator() != after->first.second) return false;
+    int rest = 1;
+    while (resumed.next()) rest++;
+    if (rest != int(std::distance(after, expected.end())) + 1) return false; // zzzz comes last
+
+    // seeking to the middle of a username, and a malformed token leaves the cursor alone
+    Cursor seeker(utree);
+    seeker.seek("dense", 999);
+    if (!seeker.next() || seeker.current()->getUsername() != "dense" || seeker.current()->getDiscriminator() != 1000) return false;
+    if (seeker.resume("nodisc") || seeker.resume("x:dense") || seeker.save() != "1000:dense") return false;
+    seeker.seek("with:colon", INVALID_DISC);
+    if (!seeker.next() || seeker.save() != "7:with:colon") return false;
+    if (!seeker.resume(seeker.save()) || !seeker.next() || seeker.current()->getUsername() != "zzzz" || seeker.next()) return false;
+    seeker.rewind();
+    if (!seeker.next() || seeker.current()->getUsername() != "a") return false;
+
+    // printUsers goes through the same walk, so it prints in order as well
+    std::stringstream printed;
+    std::streambuf * old = cout.rdbuf(printed.rdbuf());
+    utree.printUsers();
+    cout.rdbuf(old);
+    string line, previous;
+    int accounts = 0;
+    while (std::getline(printed, line)){
+        if (line.rfind("Account name: ", 0) != 0) continue;
+        if (line < previous) return false;
+        previous = line;
+        accounts++;
+    }
+    return accounts == int(expected.size()) + 2 - 1; // a and zzzz went in, one went out
+}
+
+void Tester::utreeLoadScaling(int numLines, int maxThreads){
+    std::mt19937 fileRng(341);
+    string dataFile = "scaling.csv";
+    writeAccounts(dataFile, numLines, numLines / 10, fileRng);
+
+    double base = 0.0;
+    for (int numThreads = 1; numThreads <= maxThreads; numThreads *= 2){
+        UTree tree;
+        auto start = std::chrono::steady_clock::now();
+        LoadReport report = tree.loadData(dataFile, true, numThreads);
+        auto stop = std::chrono::steady_clock::now();
+        double T = std::chrono::duration<double>(stop - start).count();
+        if (numThreads == 1) base = T;
+        cout << "Loading " << report.loaded << " accounts with " << numThreads << " threads took " << T
+             << " seconds (" << base / T << "x)" << endl;
+    }
+    std::remove(dataFile.c_str());
+}
 
 void Tester::utreeInsertPerformance(int numTrials, int n){
     double T = 0.0;
@@ -260,7 +1723,94 @@ int main() {
 
     }
     {
-
+        cout << "\nUTree: Testing Removing the Last Account of a Username\n";
+        if (tester.utreeRemoveLastAccount()) cout << "\tTest Passed\n";
+        else cout << "\tTest Failed\n";
+    }
+    {
+        cout << "\nUTree: Testing Duplicate Insert and AVL Balance\n";
+        if (tester.utreeInsertDuplicate()) cout << "\tTest Passed\n";
+        else cout << "\tTest Failed\n";
+    }
+    {
+        cout << "\nUTree: Testing Allocating Free Discriminators\n";
+        if (tester.utreeAllocateDiscriminator()) cout << "\tTest Passed\n";
+        else cout << "\tTest Failed\n";
+    }
+    {
+        cout << "\nNodePool: Testing Free List Reuse and Clear\n";
+        if (tester.nodePoolReuse()) cout << "\tTest Passed\n";
+        else cout << "\tTest Failed\n";
+    }
+    {
+        cout << "\nUTree: Testing Clear Releases the Node Pool\n";
+        if (tester.utreeClearReleasesPool()) cout << "\tTest Passed\n";
+        else cout << "\tTest Failed\n";
+    }
+    {
+        cout << "\nUTree: Testing Usernames Kept Inline in UNodes\n";
+        if (tester.utreeInlineKeys()) cout << "\tTest Passed\n";
+        else cout << "\tTest Failed\n";
+    }
+    {
+        cout << "\nUTree: Testing Lookups Without Heap Allocations\n";
+        if (tester.utreeZeroCopyLookup()) cout << "\tTest Passed\n";
+        else cout << "\tTest Failed\n";
+    }
+    {
+        cout << "\nUTree: Testing Emplace Straight Into The Pool\n";
+        if (tester.utreeEmplace()) cout << "\tTest Passed\n";
+        else cout << "\tTest Failed\n";
+    }
+    {
+        cout << "\nUTree: Testing Sorted Bulk Load\n";
+        if (tester.utreeBulkLoad()) cout << "\tTest Passed\n";
+        else cout << "\tTest Failed\n";
+    }
+    {
+        cout << "\nUTree: Testing Load Reports\n";
+        if (tester.utreeLoadReport()) cout << "\tTest Passed\n";
+        else cout << "\tTest Failed\n";
+    }
+    {
+        cout << "\nUTree: Testing Parallel Load\n";
+        if (tester.utreeParallelLoad()) cout << "\tTest Passed\n";
+        else cout << "\tTest Failed\n";
+    }
+    {
+        cout << "\nUTree: Testing Snapshots\n";
+        if (tester.utreeSnapshot()) cout << "\tTest Passed\n";
+        else cout << "\tTest Failed\n";
+    }
+    {
+        cout << "\nUTree: Testing Write-Ahead Log Recovery\n";
+        if (tester.utreeOpLog()) cout << "\tTest Passed\n";
+        else cout << "\tTest Failed\n";
+    }
+    {
+        cout << "\nUTree: Testing Concurrent Readers and Writers\n";
+        if (tester.utreeConcurrent()) cout << "\tTest Passed\n";
+        else cout << "\tTest Failed\n";
+    }
+    {
+        cout << "\nUTree: Testing Versions Frozen by Path Copying\n";
+        if (tester.utreeVersioned()) cout << "\tTest Passed\n";
+        else cout << "\tTest Failed\n";
+    }
+    {
+        cout << "\nUTree: Testing Sharding and Batches\n";
+        if (tester.utreeSharded()) cout << "\tTest Passed\n";
+        else cout << "\tTest Failed\n";
+    }
+    {
+        cout << "\nUTree: Testing Batched Inserts and Removals\n";
+        if (tester.utreeBatch()) cout << "\tTest Passed\n";
+        else cout << "\tTest Failed\n";
+    }
+    {
+        cout << "\nUTree: Testing Cursors and Paging\n";
+        if (tester.utreeCursor()) cout << "\tTest Passed\n";
+        else cout << "\tTest Failed\n";
     }
     {
         //Measuring the efficiency of insertion functionality
@@ -271,6 +1821,14 @@ int main() {
         cout << "\n";
 
     }
+    {
+        //Measuring how loading scales with threads
+        cout << "\nUTree: Measuring how loading scales from 1 to N threads:\n" << endl;
+        int lines = 200000;
+        int threads = std::max(1u, std::thread::hardware_concurrency());
+        tester.utreeLoadScaling(lines, threads);
+        cout << "\n";
+    }
 
 
 
@@ -330,11 +1888,56 @@ int main() {
         if (tester.rebalanceTest()) cout << "\tTest Passed\n";
         else cout << "\tTest Failed\n";
     }
+    {
+        cout << "\nDTree: Testing In-Place Rebalance Drops Vacant Nodes\n";
+        if (tester.dtreeRebalanceInPlace()) cout << "\tTest Passed\n";
+        else cout << "\tTest Failed\n";
+    }
+    {
+        cout << "\nDTree: Testing Scapegoat Rebalancing Keeps Every Node Balanced\n";
+        if (tester.dtreeScapegoatBalance()) cout << "\tTest Passed\n";
+        else cout << "\tTest Failed\n";
+    }
+    {
+        cout << "\nDTree: Testing Switching to and from the Dense Index\n";
+        if (tester.dtreeDenseIndex()) cout << "\tTest Passed\n";
+        else cout << "\tTest Failed\n";
+    }
+    {
+        cout << "\nDTree: Testing Rank, Select and Random Sampling\n";
+        if (tester.dtreeRankSelect()) cout << "\tTest Passed\n";
+        else cout << "\tTest Failed\n";
+    }
+    {
+        cout << "\nDTree: Testing Discriminator Range Queries\n";
+        if (tester.dtreeRangeQueries()) cout << "\tTest Passed\n";
+        else cout << "\tTest Failed\n";
+    }
+    {
+        cout << "\nDTree: Testing Compact Account Storage\n";
+        if (tester.dtreeCompactAccounts()) cout << "\tTest Passed\n";
+        else cout << "\tTest Failed\n";
+    }
+    {
+        cout << "\nDTree: Testing Vacant Nodes, Revival and Compaction\n";
+        if (tester.dtreeVacancy()) cout << "\tTest Passed\n";
+        else cout << "\tTest Failed\n";
+    }
     {
         cout << "\nDTree: Testing GetNumUsers\n";
         if (tester.dtreeGetNumUsers()) cout << "\tTest Passed\n" << endl;
         else cout << "\tTest Failed\n" << endl;
     }
+    {
+        cout << "\nDTree: Testing Insert Returns the New Node\n";
+        if (tester.dtreeInsertReturnsNode()) cout << "\tTest Passed\n";
+        else cout << "\tTest Failed\n";
+    }
+    {
+        cout << "\nDTree: Testing Size and Vacancy Bookkeeping on Insert and Remove\n";
+        if (tester.dtreeSizeBookkeeping()) cout << "\tTest Passed\n";
+        else cout << "\tTest Failed\n";
+    }
     {
         //Measuring the efficiency of insertion functionality
         cout << "\nDTree: Measuring the efficiency of insertion functionality:\n" << endl;
@@ -344,6 +1947,12 @@ int main() {
         cout << "\n";
 
     }
+    {
+        // fills the process wide badge table, so it goes after every other test
+        cout << "\nBadgeTable: Testing a Full Table Turns Down New Badges and Their Lines\n";
+        if (tester.badgeTableFull()) cout << "\tTest Passed\n";
+        else cout << "\tTest Failed\n";
+    }
 
 
 }
@@ -0,0 +1,237 @@
+/**
+ * OpLog.cpp
+ * Implementation for the OpLog class.
+ *
+ * Every record is a 4 byte payload length and the low 4 bytes of the
+ * payload's checksum, followed by the payload: the sequence number, the
+ * operation, nitro, the discriminator, the lengths of the username, badge
+ * and status, and then the three strings.
+ */
+
+#include "oplog.h"
+#include "snapshot.h"
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+OpLog::OpLog(): _fd(-1), _syncEvery(LOG_SYNC_EVERY), _appended(0), _durable(0), _syncing(false), _numSyncs(0) {}
+
+/**
+ * Destructor, makes whatever is still buffered durable and closes the file.
+ */
+OpLog::~OpLog() {
+    close();
+}
+
+/**
+ * Opens a log for appending, creating it if needed. Every intact record
+ * already in the file is handed to replay first, in order. A record cut
+ * short by a crash ends the replay and is cut off the file, so new records
+ * follow straight after the last good one.
+ * @param path file to log to
+ * @param syncEvery number of records that may be lost in a crash, 0 to only sync when asked
+ * @param replay called with every record already in the log
+ * @return true if the log was opened
+ */
+bool OpLog::open(const std::string& path, int syncEvery, const std::function<void(const LogRecord&)>& replay) {
+    close();
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    struct stat info;
+    if (fd < 0 || ::fstat(fd, &info) < 0){
+        if (fd >= 0) ::close(fd);
+        return false;
+    }
+
+    std::string contents(info.st_size, '\0');
+    size_t read = 0;
+    while (read < contents.size()){
+        ssize_t bytes = ::pread(fd, &contents[read], contents.size() - read, read);
+        if (bytes <= 0) break;
+        read += bytes;
+    }
+    contents.resize(read);
+
+    size_t offset = 0;
+    while (contents.size() - offset >= LOG_RECORD_HEADER){
+        uint32_t length, checksum;
+        std::memcpy(&length, contents.data() + offset, 4);
+        std::memcpy(&checksum, contents.data() + offset + 4, 4);
+        if (length < LOG_PAYLOAD_HEADER || length > contents.size() - offset - LOG_RECORD_HEADER) break;
+        const char* payload = contents.data() + offset + LOG_RECORD_HEADER;
+        if (static_cast<uint32_t>(snapshotChecksum(payload, length)) != checksum) break;
+
+        LogRecord record;
+        uint8_t op, nitro;
+        int16_t disc;
+        uint16_t usernameLength, badgeLength, statusLength;
+        std::memcpy(&record.sequence, payload, 8);
+        std::memcpy(&op, payload + 8, 1);
+        std::memcpy(&nitro, payload + 9, 1);
+        std::memcpy(&disc, payload + 10, 2);
+        std::memcpy(&usernameLength, payload + 12, 2);
+        std::memcpy(&badgeLength, payload + 14, 2);
+        std::memcpy(&statusLength, payload + 16, 2);
+        if (LOG_PAYLOAD_HEADER + size_t(usernameLength) + badgeLength + statusLength != length) break;
+
+        const char* strings = payload + LOG_PAYLOAD_HEADER;
+        record.op = static_cast<LogOp>(op);
+        record.nitro = nitro;
+        record.disc = disc;
+        record.username = std::string_view(strings, usernameLength);
+        record.badge = std::string_view(strings + usernameLength, badgeLength);
+        record.status = std::string_view(strings + usernameLength + badgeLength, statusLength);
+        replay(record);
+        offset += LOG_RECORD_HEADER + length;
+    }
+
+    // a torn record at the end never made it, so it is dropped rather than appended after
+    if (offset != contents.size() && (::ftruncate(fd, offset) != 0 || ::fdatasync(fd) != 0)){
+        ::close(fd);
+        return false;
+    }
+    if (::lseek(fd, offset, SEEK_SET) < 0){
+        ::close(fd);
+        return false;
+    }
+
+    std::lock_guard<std::mutex> guard(_lock);
+    _fd = fd;
+    _syncEvery = syncEvery < 0 ? 0 : syncEvery;
+    _buffer.clear();
+    _appended = 0;
+    _durable = 0;
+    return true;
+}
+
+/**
+ * Makes every buffered record durable and closes the log.
+ */
+void OpLog::close() {
+    if (_fd < 0) return;
+    sync();
+    std::lock_guard<std::mutex> guard(_lock);
+    ::close(_fd);
+    _fd = -1;
+    _buffer.clear();
+}
+
+/**
+ * Adds a record to the log. Once syncEvery records are waiting, the append
+ * does not return until they are all on disk, along with any other thread's
+ * records that came in meanwhile.
+ * @param record operation to log
+ * @return false if the log is closed, the record does not fit or it could not be made durable
+ */
+bool OpLog::append(const LogRecord& record) {
+    uint64_t ticket = enqueue(record);
+    return ticket && wait(ticket);
+}
+
+/**
+ * Adds a record to the buffer without waiting for it to become durable, so
+ * the caller can let go of its locks first and wait afterwards.
+ * @param record operation to log
+ * @return ticket to pass to wait, 0 if the log is closed or the record does not fit
+ */
+uint64_t OpLog::enqueue(const LogRecord& record) {
+    if (record.username.size() > UINT16_MAX || record.badge.size() > UINT16_MAX || record.status.size() > UINT16_MAX) return 0;
+
+    uint32_t length = LOG_PAYLOAD_HEADER + record.username.size() + record.badge.size() + record.status.size();
+    char header[LOG_RECORD_HEADER + LOG_PAYLOAD_HEADER];
+    uint8_t op = record.op;
+    uint8_t nitro = record.nitro;
+    int16_t disc = record.disc;
+    uint16_t usernameLength = record.username.size();
+    uint16_t badgeLength = record.badge.size();
+    uint16_t statusLength = record.status.size();
+    std::memcpy(header, &length, 4);
+    std::memcpy(header + 8, &record.sequence, 8);
+    std::memcpy(header + 16, &op, 1);
+    std::memcpy(header + 17, &nitro, 1);
+    std::memcpy(header + 18, &disc, 2);
+    std::memcpy(header + 20, &usernameLength, 2);
+    std::memcpy(header + 22, &badgeLength, 2);
+    std::memcpy(header + 24, &statusLength, 2);
+
+    std::lock_guard<std::mutex> guard(_lock);
+    if (_fd < 0) return 0;
+
+    size_t start = _buffer.size();
+    _buffer.append(header, sizeof(header));
+    _buffer.append(record.username);
+    _buffer.append(record.badge);
+    _buffer.append(record.status);
+    uint32_t checksum = snapshotChecksum(_buffer.data() + start + LOG_RECORD_HEADER, length);
+    std::memcpy(&_buffer[start + 4], &checksum, 4);
+
+    return ++_appended;
+}
+
+/**
+ * Waits for a record from enqueue, if syncEvery says it has to be durable by now.
+ * @param ticket ticket enqueue returned, any record before it is waited for as well
+ * @return false if the records could not be made durable
+ */
+bool OpLog::wait(uint64_t ticket) {
+    std::unique_lock<std::mutex> guard(_lock);
+    if (_fd < 0) return false;
+    if (ticket <= _durable || _syncEvery == 0 || ticket - _durable < static_cast<uint64_t>(_syncEvery)) return true;
+    return commit(guard, ticket);
+}
+
+/**
+ * Makes every record appended so far durable.
+ * @return true if they are all on disk
+ */
+bool OpLog::sync() {
+    std::unique_lock<std::mutex> guard(_lock);
+    if (_fd < 0) return false;
+    return commit(guard, _appended);
+}
+
+/**
+ * Drops every record written so far, once a checkpoint holds all of them.
+ * Records still buffered are kept and written after the cut.
+ * @return true if the log was truncated
+ */
+bool OpLog::truncate() {
+    std::unique_lock<std::mutex> guard(_lock);
+    if (_fd < 0) return false;
+    _synced.wait(guard, [this]{return !_syncing;}); // nobody may be halfway through writing
+    return ::ftruncate(_fd, 0) == 0 && ::lseek(_fd, 0, SEEK_SET) == 0 && ::fdatasync(_fd) == 0;
+}
+
+bool OpLog::commit(std::unique_lock<std::mutex>& guard, uint64_t upTo){
+    while (_durable < upTo){
+        if (_syncing){ // someone else is syncing, their sync may already cover these records
+            _synced.wait(guard);
+            continue;
+        }
+
+        // lead a sync of everything buffered so far, the lock is let go so others can keep appending
+        _syncing = true;
+        std::string pending;
+        pending.swap(_buffer);
+        uint64_t covered = _appended;
+        guard.unlock();
+
+        bool written = true;
+        for (size_t offset = 0; offset < pending.size() && written; ){
+            ssize_t bytes = ::write(_fd, pending.data() + offset, pending.size() - offset);
+            if (bytes <= 0) written = false;
+            else offset += bytes;
+        }
+        written = written && ::fdatasync(_fd) == 0;
+
+        guard.lock();
+        _syncing = false;
+        if (written){
+            _durable = covered;
+            _numSyncs++;
+        }
+        _synced.notify_all();
+        if (!written) return false;
+    }
+    return true;
+}
@@ -0,0 +1,174 @@
+/**
+ * NodePool.cpp
+ * Implementation for the NodePool class.
+ */
+
+#include "pool.h"
+
+NodePool::NodePool(): _free(), _chunks(nullptr), _cursor(nullptr), _end(nullptr),
+                      _nextChunk(POOL_FIRST_CHUNK), _large(nullptr), _concurrent(false) {}
+
+/**
+ * Destructor, frees every chunk.
+ */
+NodePool::~NodePool() {
+    clear();
+}
+
+/**
+ * Hands out a block of at least the requested size.
+ * @param bytes size of the block
+ * @return block aligned to POOL_GRAIN
+ */
+void* NodePool::allocate(size_t bytes) {
+    if (!_concurrent) return allocateBlock(bytes);
+    std::lock_guard<std::mutex> guard(_lock);
+    return allocateBlock(bytes);
+}
+
+/**
+ * Gives a block back to the pool so the next allocation of that size can reuse it.
+ * @param block block returned by allocate
+ * @param bytes size that was passed to allocate
+ */
+void NodePool::release(void* block, size_t bytes) {
+    if (!_concurrent) return releaseBlock(block, bytes);
+    std::lock_guard<std::mutex> guard(_lock);
+    releaseBlock(block, bytes);
+}
+
+void* NodePool::allocateBlock(size_t bytes){
+    if (bytes > POOL_MAX_CLASS){
+        LargeBlock* block = static_cast<LargeBlock*>(::operator new(sizeof(LargeBlock) + bytes));
+        block->_prev = nullptr;
+        block->_next = _large;
+        if (_large) _large->_prev = block;
+        _large = block;
+        return block + 1;
+    }
+
+    size_t grains = bytes ? (bytes + POOL_GRAIN - 1) / POOL_GRAIN : 1;
+    if (_free[grains]){ // reuse a released block first
+        FreeBlock* block = _free[grains];
+        _free[grains] = block->_next;
+        return block;
+    }
+
+    size_t size = grains * POOL_GRAIN;
+    if (_cursor + size > _end) newChunk(size);
+    void* block = _cursor;
+    _cursor += size;
+    return block;
+}
+
+void NodePool::releaseBlock(void* block, size_t bytes){
+    if (!block) return;
+
+    if (bytes > POOL_MAX_CLASS){
+        LargeBlock* large = static_cast<LargeBlock*>(block) - 1;
+        if (large->_prev) large->_prev->_next = large->_next;
+        else _large = large->_next;
+        if (large->_next) large->_next->_prev = large->_prev;
+        ::operator delete(large);
+        return;
+    }
+
+    size_t grains = bytes ? (bytes + POOL_GRAIN - 1) / POOL_GRAIN : 1;
+    FreeBlock* freed = static_cast<FreeBlock*>(block);
+    freed->_next = _free[grains];
+    _free[grains] = freed;
+}
+
+/**
+ * Frees every chunk at once, invalidating every block the pool handed out.
+ * Nothing in the blocks is destroyed.
+ */
+void NodePool::clear() {
+    while (_chunks){
+        Chunk* next = _chunks->_next;
+        ::operator delete(_chunks);
+        _chunks = next;
+    }
+    while (_large){
+        LargeBlock* next = _large->_next;
+        ::operator delete(_large);
+        _large = next;
+    }
+
+    for (FreeBlock*& list : _free) list = nullptr;
+    _cursor = nullptr;
+    _end = nullptr;
+    _nextChunk = POOL_FIRST_CHUNK;
+}
+
+/**
+ * Takes over every chunk, large block and free block of another pool, which
+ * is left empty. Blocks handed out by either pool can then be released into
+ * this one, and live until this one is cleared.
+ * @param other pool to empty into this one
+ */
+void NodePool::merge(NodePool& other) {
+    if (&other == this) return;
+
+    if (other._chunks){
+        Chunk* last = other._chunks;
+        while (last->_next) last = last->_next;
+        last->_next = _chunks;
+        _chunks = other._chunks;
+        // keep carving out of whichever pool has more room left in its newest chunk
+        if (other._end - other._cursor > _end - _cursor){
+            _cursor = other._cursor;
+            _end = other._end;
+        }
+        if (other._nextChunk > _nextChunk) _nextChunk = other._nextChunk;
+    }
+
+    if (other._large){
+        LargeBlock* last = other._large;
+        while (last->_next) last = last->_next;
+        last->_next = _large;
+        if (_large) _large->_prev = last;
+        _large = other._large;
+    }
+
+    for (size_t grains = 0; grains <= POOL_MAX_CLASS / POOL_GRAIN; grains++){
+        if (!other._free[grains]) continue;
+        FreeBlock* last = other._free[grains];
+        while (last->_next) last = last->_next;
+        last->_next = _free[grains];
+        _free[grains] = other._free[grains];
+    }
+
+    // forget everything without freeing it, it belongs to this pool now
+    other._chunks = nullptr;
+    other._large = nullptr;
+    for (FreeBlock*& list : other._free) list = nullptr;
+    other._cursor = nullptr;
+    other._end = nullptr;
+    other._nextChunk = POOL_FIRST_CHUNK;
+}
+
+/**
+ * Returns the number of chunks the pool is holding.
+ * @return number of chunks
+ */
+int NodePool::getNumChunks() const {
+    int count = 0;
+    for (Chunk* chunk = _chunks; chunk; chunk = chunk->_next) count++;
+    return count;
+}
+
+void NodePool::newChunk(size_t bytes){
+    // whatever is left of the current chunk is too small and gets skipped
+    size_t header = (sizeof(Chunk) + POOL_GRAIN - 1) / POOL_GRAIN * POOL_GRAIN;
+    size_t size = _nextChunk;
+    if (size < header + bytes) size = header + bytes;
+    if (_nextChunk < POOL_MAX_CHUNK) _nextChunk *= 2;
+
+    Chunk* chunk = static_cast<Chunk*>(::operator new(size));
+    chunk->_next = _chunks;
+    chunk->_size = size;
+    _chunks = chunk;
+    _cursor = reinterpret_cast<char*>(chunk) + header;
+    _end = reinterpret_cast<char*>(chunk) + size;
+}
@@ -0,0 +1,87 @@
+/**
+ * NodePool.h
+ * An interface for the NodePool class, the allocator behind the nodes
+ * of a UTree and its DTrees.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <mutex>
+
+#define POOL_GRAIN 16               // every block is a multiple of this, which also keeps them aligned
+#define POOL_MAX_CLASS 256          // bigger blocks skip the free lists and come straight from the heap
+#define POOL_FIRST_CHUNK 4096       // size of the first chunk, each new chunk doubles it
+#define POOL_MAX_CHUNK (1 << 20)    // chunks stop growing at this size
+
+class Grader;   /* For grading purposes */
+class Tester;   /* Forward declaration for testing class */
+
+/**
+ * Hands out small blocks carved out of large chunks, with one free list per
+ * size class so removed nodes get reused. Releasing the whole pool only frees
+ * the chunks, no matter how many nodes were carved out of them.
+ * A pool is only safe to share between threads once setConcurrent is on.
+ */
+class NodePool {
+    friend class Grader;
+    friend class Tester;
+
+public:
+    NodePool();
+    ~NodePool();
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+
+    void* allocate(size_t bytes);
+    void release(void* block, size_t bytes);
+    void clear();
+    void merge(NodePool& other);
+    void setConcurrent(bool concurrent) {_concurrent = concurrent;}
+
+    /* Constructs a T inside a block of the pool */
+    template <class T, class... Args>
+    T* make(Args&&... args) {
+        return new (allocate(sizeof(T))) T(std::forward<Args>(args)...);
+    }
+
+    /* Destroys a T made by make() and puts its block on a free list */
+    template <class T>
+    void destroy(T* object) {
+        if (!object) return;
+        object->~T();
+        release(object, sizeof(T));
+    }
+
+    int getNumChunks() const;
+
+private:
+    struct FreeBlock {
+        FreeBlock* _next;
+    };
+
+    struct Chunk {
+        Chunk* _next;
+        size_t _size;
+    };
+
+    struct LargeBlock { // header in front of every block bigger than POOL_MAX_CLASS
+        LargeBlock* _prev;
+        LargeBlock* _next;
+    };
+
+    FreeBlock* _free[POOL_MAX_CLASS / POOL_GRAIN + 1]; // indexed by size in grains
+    Chunk* _chunks;
+    char* _cursor; // next unused byte of the newest chunk
+    char* _end;
+    size_t _nextChunk;
+    LargeBlock* _large;
+    bool _concurrent; // allocate and release take _lock
+    std::mutex _lock;
+
+    void* allocateBlock(size_t bytes); // allocate without the lock
+    void releaseBlock(void* block, size_t bytes); // release without the lock
+    void newChunk(size_t bytes); // starts a chunk that can fit at least bytes
+};
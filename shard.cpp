@@ -0,0 +1,218 @@
+/**
+ * Shard.cpp
+ * Implementation for the ShardedUTree class.
+ */
+
+#include "shard.h"
+
+/**
+ * Makes an empty tree of numShards shards.
+ * @param numShards number of shards, at least 1
+ */
+ShardedUTree::ShardedUTree(int numShards): _numShards(numShards < 1 ? 1 : numShards), _shards(new Shard[_numShards]) {}
+
+/**
+ * Inserts an account into the shard of its username.
+ * @param newAcct Account object to be inserted
+ * @return true if the account was inserted, false otherwise
+ */
+bool ShardedUTree::insert(const Account& newAcct) {
+    Shard& shard = _shards[shardOf(newAcct.getUsername())];
+    std::unique_lock<std::shared_mutex> guard(shard.lock);
+    return shard.tree.insert(newAcct);
+}
+
+/**
+ * Inserts an account built straight from its fields, see UTree::emplace.
+ * @return true if the account was inserted, false otherwise
+ */
+bool ShardedUTree::emplace(std::string_view username, int disc, bool nitro, std::string_view badge, std::string_view status) {
+    Shard& shard = _shards[shardOf(username)];
+    std::unique_lock<std::shared_mutex> guard(shard.lock);
+    return shard.tree.emplace(username, disc, nitro, badge, status);
+}
+
+/**
+ * Picks a free discriminator for the account's username and inserts the
+ * account with it, see UTree::allocateDiscriminator.
+ * @param newAcct Account object to be inserted, its discriminator is ignored
+ * @param policy LOWEST_FREE for the smallest free discriminator, RANDOM_FREE for a uniformly random one
+ * @param rng random number generator used by RANDOM_FREE, owned by the calling thread
+ * @return the discriminator the account got, INVALID_DISC if the username has none left
+ */
+int ShardedUTree::allocateDiscriminator(const Account& newAcct, AllocPolicy policy, std::mt19937& rng) {
+    Shard& shard = _shards[shardOf(newAcct.getUsername())];
+    std::unique_lock<std::shared_mutex> guard(shard.lock);
+    return shard.tree.allocateDiscriminator(newAcct, policy, rng);
+}
+
+/**
+ * Removes a user with a matching username and discriminator.
+ * @param username username to match
+ * @param disc discriminator to match
+ * @return true if an account was removed, false otherwise
+ */
+bool ShardedUTree::removeUser(std::string_view username, int disc) {
+    Shard& shard = _shards[shardOf(username)];
+    std::unique_lock<std::shared_mutex> guard(shard.lock);
+    return shard.tree.removeUser(username, disc);
+}
+
+/**
+ * Copies out the account of a user.
+ * @param username username to match
+ * @param disc discriminator to match
+ * @param found set to the account if the user exists
+ * @return true if the user exists
+ */
+bool ShardedUTree::retrieveUser(std::string_view username, int disc, Account& found) {
+    Shard& shard = _shards[shardOf(username)];
+    std::shared_lock<std::shared_mutex> guard(shard.lock);
+    DNode* user = shard.tree.retrieveUser(username, disc);
+    if (!user) return false;
+    found = user->getAccount();
+    return true;
+}
+
+/**
+ * Checks if a user exists.
+ * @param username username to match
+ * @param disc discriminator to match
+ * @return true if the user exists
+ */
+bool ShardedUTree::hasUser(std::string_view username, int disc) {
+    Shard& shard = _shards[shardOf(username)];
+    std::shared_lock<std::shared_mutex> guard(shard.lock);
+    return shard.tree.retrieveUser(username, disc) != nullptr;
+}
+
+/**
+ * Returns the number of users with a specific username.
+ * @param username username to match
+ * @return number of users with the specified username
+ */
+int ShardedUTree::numUsers(std::string_view username) {
+    Shard& shard = _shards[shardOf(username)];
+    std::shared_lock<std::shared_mutex> guard(shard.lock);
+    return shard.tree.numUsers(username);
+}
+
+/**
+ * Inserts a batch of accounts. They are split by shard and every shard takes
+ * its part in one sorted bulk load, see UTree::bulkLoad, with the shards
+ * spread over numThreads threads.
+ * @param accounts accounts to insert, in any order, sorted by shard on return
+ * @param numThreads number of threads to load with
+ * @return number of accounts inserted
+ */
+int ShardedUTree::bulkLoad(std::vector<AccountRef>& accounts, int numThreads) {
+    std::vector<std::string_view> usernames;
+    usernames.reserve(accounts.size());
+    for (const AccountRef& account : accounts) usernames.push_back(account.username);
+    std::vector<int> order;
+    std::vector<int> starts = groupByShard(usernames, order);
+
+    std::vector<AccountRef> grouped;
+    grouped.reserve(accounts.size());
+    for (int index : order) grouped.push_back(accounts[index]);
+    accounts.swap(grouped);
+
+    std::vector<int> loaded(_numShards, 0);
+    numThreads = std::max(1, std::min(numThreads, _numShards));
+    UTree::runParallel(numThreads, [&](int t){
+        for (int s = t; s < _numShards; s += numThreads){
+            if (starts[s] == starts[s + 1]) continue;
+            std::vector<AccountRef> part(accounts.begin() + starts[s], accounts.begin() + starts[s + 1]);
+            std::unique_lock<std::shared_mutex> guard(_shards[s].lock);
+            loaded[s] = _shards[s].tree.bulkLoad(part);
+        }
+    });
+
+    int total = 0;
+    for (int count : loaded) total += count;
+    return total;
+}
+
+/**
+ * Runs a batch of operations, taking every shard's lock once for all of its
+ * operations instead of once per operation. Operations on the same username
+ * are in the same shard and run in the order they are in the batch; there
+ * is no order between different shards. The shards are spread over
+ * numThreads threads.
+ * @param ops operations to run, done is set on each
+ * @param numThreads number of threads to run the shards on
+ * @return number of operations that were done
+ */
+int ShardedUTree::applyBatch(std::vector<ShardOp>& ops, int numThreads) {
+    std::vector<std::string_view> usernames;
+    usernames.reserve(ops.size());
+    for (const ShardOp& op : ops) usernames.push_back(op.account.username);
+    std::vector<int> order;
+    std::vector<int> starts = groupByShard(usernames, order);
+
+    std::vector<int> done(_numShards, 0);
+    numThreads = std::max(1, std::min(numThreads, _numShards));
+    UTree::runParallel(numThreads, [&](int t){
+        for (int s = t; s < _numShards; s += numThreads){
+            if (starts[s] == starts[s + 1]) continue;
+            // a batch of nothing but lookups does not hold up other readers of the shard
+            bool readOnly = true;
+            for (int i = starts[s]; i < starts[s + 1] && readOnly; i++) readOnly = ops[order[i]].type == SHARD_RETRIEVE;
+            std::shared_lock<std::shared_mutex> reading(_shards[s].lock, std::defer_lock);
+            std::unique_lock<std::shared_mutex> writing(_shards[s].lock, std::defer_lock);
+            if (readOnly) reading.lock();
+            else writing.lock();
+            for (int i = starts[s]; i < starts[s + 1]; i++) done[s] += applyOp(_shards[s].tree, ops[order[i]]);
+        }
+    });
+
+    int total = 0;
+    for (int count : done) total += count;
+    return total;
+}
+
+/**
+ * Removes every account of every shard.
+ */
+void ShardedUTree::clear() {
+    for (int s = 0; s < _numShards; s++){
+        std::unique_lock<std::shared_mutex> guard(_shards[s].lock);
+        _shards[s].tree.clear();
+    }
+}
+
+int ShardedUTree::shardOf(std::string_view username) const{
+    return std::hash<std::string_view>()(username) % _numShards;
+}
+
+std::vector<int> ShardedUTree::groupByShard(const std::vector<std::string_view>& usernames, std::vector<int>& order) const{
+    std::vector<int> shards(usernames.size());
+    std::vector<int> starts(_numShards + 1, 0);
+    for (size_t i = 0; i < usernames.size(); i++){
+        shards[i] = shardOf(usernames[i]);
+        starts[shards[i] + 1]++;
+    }
+    for (int s = 0; s < _numShards; s++) starts[s + 1] += starts[s];
+
+    // stable, so every shard keeps its operations in batch order
+    std::vector<int> next(starts.begin(), starts.end() - 1);
+    order.assign(usernames.size(), 0);
+    for (size_t i = 0; i < usernames.size(); i++) order[next[shards[i]]++] = i;
+    return starts;
+}
+
+bool ShardedUTree::applyOp(UTree& tree, ShardOp& op){
+    const AccountRef& account = op.account;
+    switch (op.type){
+    case SHARD_INSERT:
+        op.done = tree.emplace(account.username, account.disc, account.nitro, account.badge, account.status);
+        break;
+    case SHARD_REMOVE:
+        op.done = tree.removeUser(account.username, account.disc);
+        break;
+    case SHARD_RETRIEVE:
+        op.done = tree.retrieveUser(account.username, account.disc) != nullptr;
+        break;
+    }
+    return op.done;
+}
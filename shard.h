@@ -0,0 +1,68 @@
+/**
+ * Shard.h
+ * An interface for the ShardedUTree class, usernames spread over several
+ * independent UTrees so writers of different usernames never meet.
+ */
+
+#pragma once
+
+#include "utree.h"
+#include <memory>
+#include <shared_mutex>
+
+#define SHARD_COUNT 16 // shards a ShardedUTree gets unless told otherwise
+
+class Grader;   /* For grading purposes */
+class Tester;   /* Forward declaration for testing class */
+
+enum ShardOpType : uint8_t {SHARD_INSERT, SHARD_REMOVE, SHARD_RETRIEVE};
+
+/* One operation of a batch, done is filled in with what insert, removeUser or hasUser returned */
+struct ShardOp {
+    ShardOpType type;
+    AccountRef account; // only the username and discriminator are needed to remove or retrieve
+    bool done;
+};
+
+/**
+ * UTree split into shards by a hash of the username. Every shard is a UTree
+ * of its own, with its own lock and its own pool, so operations on usernames
+ * that land in different shards share nothing at all; with enough shards
+ * for the threads writing, most of them never wait. All accounts of a
+ * username are in one shard, so anything about one username still takes a
+ * single lock.
+ */
+class ShardedUTree {
+    friend class Grader;
+    friend class Tester;
+
+public:
+    ShardedUTree(int numShards = SHARD_COUNT);
+    ShardedUTree(const ShardedUTree&) = delete;
+    ShardedUTree& operator=(const ShardedUTree&) = delete;
+
+    bool insert(const Account& newAcct);
+    bool emplace(std::string_view username, int disc, bool nitro, std::string_view badge, std::string_view status);
+    int allocateDiscriminator(const Account& newAcct, AllocPolicy policy, std::mt19937& rng);
+    bool removeUser(std::string_view username, int disc);
+    bool retrieveUser(std::string_view username, int disc, Account& found);
+    bool hasUser(std::string_view username, int disc);
+    int numUsers(std::string_view username);
+    int bulkLoad(std::vector<AccountRef>& accounts, int numThreads = 1);
+    int applyBatch(std::vector<ShardOp>& ops, int numThreads = 1);
+    void clear();
+    int getNumShards() const {return _numShards;}
+
+private:
+    struct alignas(CACHE_LINE) Shard {
+        std::shared_mutex lock; // shared to read the tree, exclusive to change it
+        UTree tree;
+    };
+
+    int _numShards;
+    std::unique_ptr<Shard[]> _shards;
+
+    int shardOf(std::string_view username) const; // shard every account of a username lives in
+    std::vector<int> groupByShard(const std::vector<std::string_view>& usernames, std::vector<int>& order) const; // counting sort, returns where every shard's run starts
+    bool applyOp(UTree& tree, ShardOp& op); // runs one operation with its shard's lock held
+};
@@ -0,0 +1,294 @@
+/**
+ * Snapshot.cpp
+ * Saving a UTree to a binary snapshot and restoring it, see snapshot.h for the layout.
+ */
+
+#include "snapshot.h"
+#include "utree.h"
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Writes every account of the tree to a snapshot, which loadSnapshot can
+ * restore without parsing or inserting anything. The snapshot is written
+ * next to path first and renamed over it, so an existing snapshot is never
+ * left half written.
+ * @param path file to write the snapshot to
+ * @return true if the snapshot was written
+ */
+bool UTree::saveSnapshot(const string& path) const {
+    SnapshotWriter writer;
+    writer.addBadges();
+    snapshotTraverse(this->_root, writer);
+    return writeSnapshot(path, writer, _sequence);
+}
+
+/**
+ * Writes out everything gathered for a snapshot, next to path first and
+ * then renamed over it.
+ * @param path file to write the snapshot to
+ * @param writer records and strings of the snapshot
+ * @param sequence sequence number of the last change the snapshot holds
+ * @return true if the snapshot was written
+ */
+bool writeSnapshot(const string& path, const SnapshotWriter& writer, uint64_t sequence) {
+    SnapshotHeader header = {};
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.headerSize = sizeof(SnapshotHeader);
+    header.numBadges = writer.badges.size();
+    header.numUNodes = writer.unodes.size();
+    header.numDNodes = writer.dnodes.size();
+    header.stringBytes = writer.strings.size();
+    header.sequence = sequence;
+
+    string body;
+    body.append(reinterpret_cast<const char*>(writer.badges.data()), writer.badges.size() * sizeof(SnapshotBadge));
+    body.append(reinterpret_cast<const char*>(writer.unodes.data()), writer.unodes.size() * sizeof(SnapshotUNode));
+    body.append(reinterpret_cast<const char*>(writer.dnodes.data()), writer.dnodes.size() * sizeof(SnapshotDNode));
+    body.append(writer.strings);
+    header.checksum = snapshotChecksum(body.data(), body.size());
+
+    string temp = path + ".tmp";
+    FILE* file = std::fopen(temp.c_str(), "wb");
+    if (!file) return false;
+    bool written = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   std::fwrite(body.data(), 1, body.size(), file) == body.size();
+    written = (std::fflush(file) == 0) && written;
+    written = (::fsync(fileno(file)) == 0) && written;
+    written = (std::fclose(file) == 0) && written;
+    if (!written || std::rename(temp.c_str(), path.c_str()) != 0){
+        std::remove(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Replaces the contents of the tree with a snapshot written by saveSnapshot.
+ * The file is mapped and its checksum verified before the tree is touched,
+ * so a missing or corrupt snapshot leaves the tree as it was. Restoring is
+ * one pass over the records: the string table is copied into the pool in
+ * one go and every node points into it, and the trees come back in the
+ * exact shape they were saved in, without a single comparison.
+ * @param path file to read the snapshot from
+ * @return true if the snapshot was restored
+ */
+bool UTree::loadSnapshot(const string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || ::fstat(fd, &info) < 0 || static_cast<size_t>(info.st_size) < sizeof(SnapshotHeader)){
+        if (fd >= 0) ::close(fd);
+        return false;
+    }
+    size_t length = info.st_size;
+    void* mapping = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) return false;
+    const char* data = static_cast<const char*>(mapping);
+
+    // every section has to fit the file exactly before anything is trusted
+    SnapshotHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    uint64_t body = length - sizeof(header);
+    bool valid = std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) == 0 &&
+                 header.version == SNAPSHOT_VERSION && header.headerSize == sizeof(SnapshotHeader) &&
+                 header.numBadges <= MAX_BADGES && header.numUNodes <= body / sizeof(SnapshotUNode) &&
+                 header.numDNodes <= body / sizeof(SnapshotDNode) && header.stringBytes <= body &&
+                 header.numBadges * sizeof(SnapshotBadge) + header.numUNodes * sizeof(SnapshotUNode) +
+                 header.numDNodes * sizeof(SnapshotDNode) + header.stringBytes == body &&
+                 snapshotChecksum(data + sizeof(header), body) == header.checksum;
+    if (!valid){
+        ::munmap(mapping, length);
+        return false;
+    }
+
+    this->clear();
+    // a log that is open may already hold records past the snapshot, their sequence numbers must not be reused
+    _sequence = _log.isOpen() ? std::max(_sequence.load(), header.sequence) : header.sequence;
+
+    const char* section = data + sizeof(header);
+    const SnapshotBadge* badges = reinterpret_cast<const SnapshotBadge*>(section);
+    section += header.numBadges * sizeof(SnapshotBadge);
+    SnapshotReader reader;
+    reader.unodes = reinterpret_cast<const SnapshotUNode*>(section);
+    reader.numUNodes = header.numUNodes;
+    reader.nextUNode = 0;
+    section += header.numUNodes * sizeof(SnapshotUNode);
+    reader.dnodes = reinterpret_cast<const SnapshotDNode*>(section);
+    reader.numDNodes = header.numDNodes;
+    reader.nextDNode = 0;
+    section += header.numDNodes * sizeof(SnapshotDNode);
+
+    // one copy of the whole string table, its strings are padded so each can later be released like any pool block;
+    // past POOL_MAX_CLASS a release frees a heap block of its own, so those strings are copied out on their own instead
+    reader.stringBytes = header.stringBytes;
+    reader.strings = header.stringBytes ? static_cast<char*>(_pool.allocate(header.stringBytes)) : nullptr;
+    if (header.stringBytes) std::memcpy(reader.strings, section, header.stringBytes);
+
+    bool ok = true;
+    reader.numBadges = header.numBadges;
+    for (size_t i = 0; i < reader.numBadges && ok; i++){
+        const char* name = reader.string(badges[i].offset, badges[i].length);
+        int id = name ? BadgeTable::intern(std::string_view(name, badges[i].length)) : INVALID_BADGE;
+        if (id == INVALID_BADGE) ok = false; // written wrong, or this process has run out of badges
+        else reader.badges[i] = id;
+    }
+
+    if (ok && reader.numUNodes) this->_root = restoreTraverse(reader, ok);
+    ::munmap(mapping, length);
+
+    if (!ok || reader.nextUNode != reader.numUNodes || reader.nextDNode != reader.numDNodes){
+        this->clear(); // the checksum matched, so only a snapshot written wrong gets here
+        return false;
+    }
+
+    if (_log.isOpen()) checkpoint(); // the log was about the tree that just got replaced
+    return true;
+}
+
+void UTree::snapshotTraverse(UNode * node, SnapshotWriter& writer) const{
+    if (!node) return;
+
+    // the record is patched once its DTree has been written and the number of DNodes is known
+    size_t index = writer.unodes.size();
+    SnapshotUNode record = {};
+    record.keyOffset = writer.addString(node->getUsername(), true);
+    record.keyLength = node->_keyLength;
+    record.flags = (node->_left ? SNAPSHOT_LEFT : 0) | (node->_right ? SNAPSHOT_RIGHT : 0) |
+                   (node->_dtree.isDense() ? SNAPSHOT_DENSE : 0);
+    writer.unodes.push_back(record);
+
+    size_t before = writer.dnodes.size();
+    node->_dtree.saveRecords(writer);
+    writer.unodes[index].numDNodes = writer.dnodes.size() - before;
+
+    snapshotTraverse(node->_left, writer);
+    snapshotTraverse(node->_right, writer);
+}
+
+UNode * UTree::restoreTraverse(SnapshotReader& reader, bool& ok){
+    if (!ok || reader.nextUNode == reader.numUNodes){
+        ok = false;
+        return nullptr;
+    }
+
+    const SnapshotUNode& record = reader.unodes[reader.nextUNode++];
+    const char * key = reader.string(record.keyOffset, uint64_t(record.keyLength) + 1);
+    if (!key || record.keyLength == 0 || key[record.keyLength] != '\0'){
+        ok = false;
+        return nullptr;
+    }
+
+    UNode * node = _pool.make<UNode>(&_pool);
+    if (record.keyLength + 1 > POOL_MAX_CLASS){
+        char * copy = static_cast<char*>(_pool.allocate(record.keyLength + 1));
+        std::memcpy(copy, key, record.keyLength + 1);
+        node->_key = copy;
+    }else if (record.keyLength >= KEY_INLINE){
+        node->_key = key; // already a padded block of the pool
+    }else{
+        std::memcpy(node->_inlineKey, key, record.keyLength + 1);
+    }
+    node->_keyLength = record.keyLength;
+    node->_dtree._username = node->_key;
+
+    if (!node->_dtree.restoreRecords(reader, record.numDNodes, record.flags & SNAPSHOT_DENSE)) ok = false;
+    if (record.flags & SNAPSHOT_LEFT) node->_left = restoreTraverse(reader, ok);
+    if (record.flags & SNAPSHOT_RIGHT) node->_right = restoreTraverse(reader, ok);
+    updateHeight(node);
+    return node;
+}
+
+void DTree::saveRecords(SnapshotWriter& writer) const{
+    if (!_dense){
+        saveTraverse(this->_root, writer);
+        return;
+    }
+
+    for (int disc = MIN_DISC; disc <= MAX_DISC; disc++){
+        if (_dense->test(disc)) saveTraverse(_dense->find(disc), writer);
+    }
+}
+
+void DTree::saveTraverse(const DNode* node, SnapshotWriter& writer) const{
+    if (!node) return;
+
+    SnapshotDNode record = {};
+    record.statusOffset = node->_statusLength ? writer.addString(node->getStatus(), false) : 0;
+    record.statusLength = node->_statusLength;
+    record.disc = node->_disc;
+    record.badge = node->_badge;
+    record.flags = (node->_nitro ? SNAPSHOT_NITRO : 0) | (node->_vacant ? SNAPSHOT_VACANT : 0);
+    if (!_dense) record.flags |= (node->_left ? SNAPSHOT_LEFT : 0) | (node->_right ? SNAPSHOT_RIGHT : 0);
+    writer.dnodes.push_back(record);
+
+    if (_dense) return;
+    saveTraverse(node->_left, writer);
+    saveTraverse(node->_right, writer);
+}
+
+bool DTree::restoreRecords(SnapshotReader& reader, uint32_t count, bool dense){
+    if (count > reader.numDNodes - reader.nextDNode) return false;
+    if (count == 0) return !dense;
+    size_t end = reader.nextDNode + count;
+
+    if (!dense){
+        bool ok = true;
+        this->_root = restoreTraverse(reader, end, ok);
+        return ok && reader.nextDNode == end;
+    }
+
+    _dense = pool()->make<DenseIndex>();
+    while (reader.nextDNode < end){
+        DNode* node = restoreNode(reader);
+        if (!node) return false;
+        if (node->_vacant || _dense->test(node->_disc)){ // a dense index has no room for either
+            freeNode(node);
+            return false;
+        }
+        _dense->set(node->_disc, node);
+    }
+    return true;
+}
+
+DNode* DTree::restoreTraverse(SnapshotReader& reader, size_t end, bool& ok){
+    if (!ok || reader.nextDNode == end){
+        ok = false;
+        return nullptr;
+    }
+
+    uint8_t flags = reader.dnodes[reader.nextDNode].flags;
+    DNode* node = restoreNode(reader);
+    if (!node){
+        ok = false;
+        return nullptr;
+    }
+    if (flags & SNAPSHOT_LEFT) node->_left = restoreTraverse(reader, end, ok);
+    if (flags & SNAPSHOT_RIGHT) node->_right = restoreTraverse(reader, end, ok);
+    updateSize(node);
+    updateNumVacant(node);
+    return node;
+}
+
+DNode* DTree::restoreNode(SnapshotReader& reader){
+    const SnapshotDNode& record = reader.dnodes[reader.nextDNode++];
+    if (record.disc < MIN_DISC || record.disc > MAX_DISC || record.badge >= reader.numBadges) return nullptr;
+    if (record.statusLength > MAX_STATUS_LENGTH) return nullptr;
+    const char* status = record.statusLength ? reader.string(record.statusOffset, record.statusLength) : nullptr;
+    if (record.statusLength && !status) return nullptr;
+
+    DNode* node = pool()->make<DNode>();
+    node->_username = _username;
+    if (record.statusLength > POOL_MAX_CLASS) node->_status = copyStatus(status, record.statusLength);
+    else node->_status = status; // already a padded block of the pool
+    node->_statusLength = record.statusLength;
+    node->_disc = record.disc;
+    node->_badge = reader.badges[record.badge];
+    node->_nitro = record.flags & SNAPSHOT_NITRO;
+    node->_vacant = record.flags & SNAPSHOT_VACANT;
+    return node;
+}
@@ -0,0 +1,133 @@
+/**
+ * Snapshot.h
+ * The on-disk layout of a UTree snapshot, shared by the UTree and DTree
+ * code that writes and restores it.
+ *
+ * A snapshot is, in order:
+ *   SnapshotHeader
+ *   SnapshotBadge[numBadges]   names of the badge ids the DNodes use
+ *   SnapshotUNode[numUNodes]   the UTree in pre-order
+ *   SnapshotDNode[numDNodes]   every DTree in pre-order, or ascending when dense, in the order of their UNodes
+ *   char[stringBytes]          string table, every string padded to POOL_GRAIN
+ *
+ * Integers are stored in the byte order of the machine that wrote the
+ * snapshot. The checksum covers everything past the header. The sequence
+ * is that of the last logged operation the snapshot holds, so replaying
+ * the log on top of it can skip what is already in.
+ */
+
+#pragma once
+
+#include "dtree.h"
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#define SNAPSHOT_MAGIC "UTREESNP"
+#define SNAPSHOT_VERSION 2
+
+#define SNAPSHOT_LEFT 1     // the node has a left subtree, which comes next
+#define SNAPSHOT_RIGHT 2    // the node has a right subtree, which comes after the left one
+#define SNAPSHOT_DENSE 4    // UNode only, its DTree was in dense mode
+#define SNAPSHOT_NITRO 4    // DNode only
+#define SNAPSHOT_VACANT 8   // DNode only
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t numBadges;
+    uint64_t numUNodes;
+    uint64_t numDNodes;
+    uint64_t stringBytes;
+    uint64_t sequence;
+    uint64_t checksum;
+};
+
+struct SnapshotBadge {
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct SnapshotUNode {
+    uint32_t keyOffset; // the key is null terminated in the string table
+    uint32_t keyLength;
+    uint32_t numDNodes;
+    uint32_t flags;
+};
+
+struct SnapshotDNode {
+    uint32_t statusOffset;
+    uint16_t statusLength;
+    int16_t disc;
+    uint8_t badge; // index into the snapshot's badges, not the BadgeTable
+    uint8_t flags;
+    uint16_t padding;
+};
+
+static_assert(sizeof(SnapshotHeader) == 64, "snapshot header layout changed");
+static_assert(sizeof(SnapshotUNode) == 16 && sizeof(SnapshotDNode) == 12, "snapshot record layout changed");
+
+/* FNV-1a over 8 byte words, which is plenty to catch a torn or corrupted file */
+inline uint64_t snapshotChecksum(const char* data, size_t length) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    const uint64_t prime = 0x100000001b3ULL;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8){
+        uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * prime;
+    }
+    for (; i < length; i++) hash = (hash ^ static_cast<unsigned char>(data[i])) * prime;
+    return hash;
+}
+
+/* Everything a snapshot holds, gathered before it is written out */
+struct SnapshotWriter {
+    std::vector<SnapshotBadge> badges;
+    std::vector<SnapshotUNode> unodes;
+    std::vector<SnapshotDNode> dnodes;
+    std::string strings;
+
+    /* Adds every badge of the BadgeTable, so badge ids can be saved as they are */
+    void addBadges() {
+        int numBadges = BadgeTable::count();
+        for (int id = 0; id < numBadges; id++){
+            const std::string& name = BadgeTable::name(id);
+            badges.push_back({addString(name, false), static_cast<uint32_t>(name.size())});
+        }
+    }
+
+    /* Appends a string padded to POOL_GRAIN, so its copy can later be handed back to a pool like any block */
+    uint32_t addString(std::string_view text, bool terminate) {
+        uint32_t offset = strings.size();
+        size_t length = text.size() + (terminate ? 1 : 0);
+        strings.append(text.data(), text.size());
+        strings.append((length + POOL_GRAIN - 1) / POOL_GRAIN * POOL_GRAIN - text.size(), '\0');
+        return offset;
+    }
+};
+
+bool writeSnapshot(const std::string& path, const SnapshotWriter& writer, uint64_t sequence);
+
+/* Cursor over the records of a mapped snapshot, with its string table already copied into the pool */
+struct SnapshotReader {
+    const SnapshotUNode* unodes;
+    size_t numUNodes;
+    size_t nextUNode;
+    const SnapshotDNode* dnodes;
+    size_t numDNodes;
+    size_t nextDNode;
+    char* strings;
+    uint64_t stringBytes;
+    uint8_t badges[MAX_BADGES]; // snapshot badge index to BadgeTable id
+    size_t numBadges;
+
+    /* Returns the string at offset, nullptr if it does not fit in the string table */
+    char* string(uint64_t offset, uint64_t length) const {
+        if (offset > stringBytes || length > stringBytes - offset) return nullptr;
+        return strings + offset;
+    }
+};
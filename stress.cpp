@@ -0,0 +1,274 @@
+/**
+ * stress.cpp
+ * Multi-threaded stress test for ConcurrentUTree and a throughput benchmark
+ * of the ways to share a UTree, kept out of mytest since a run takes a while.
+ *
+ * Usage: ./stress [max threads] [seconds per measurement]
+ */
+
+#include "cutree.h"
+#include "shard.h"
+#include <chrono>
+#include <mutex>
+#include <cstdlib>
+
+#define STRESS_NAMES 2000       // usernames in the tree
+#define STRESS_DISCS 64         // discriminators per username every thread starts out with
+
+struct LockedUTree;
+
+class Tester {
+public:
+    bool stressReadersWriters(int numThreads, double seconds);
+    template <class Tree, class Operation>
+    double measure(Tree& tree, int numThreads, double seconds, Operation operation);
+    template <class Operation>
+    void compare(ConcurrentUTree& concurrent, ShardedUTree& sharded, LockedUTree& locked, int maxThreads, double seconds, Operation operation);
+    void throughput(int maxThreads, double seconds, int writePercent);
+    void signups(int maxThreads, double seconds);
+    bool checkAVL(UNode* node, int& height);
+    bool checkCounts(DNode* node, int& size, int& numVacant);
+    string name(int i) {return (i % 7 ? "user" : string(40, 's')) + std::to_string(i);}
+};
+
+/* The tree the way it is shared today: a plain UTree behind one mutex */
+struct LockedUTree {
+    UTree tree;
+    std::mutex lock;
+
+    bool emplace(std::string_view username, int disc, bool nitro, std::string_view badge, std::string_view status) {
+        std::lock_guard<std::mutex> guard(lock);
+        return tree.emplace(username, disc, nitro, badge, status);
+    }
+    bool removeUser(std::string_view username, int disc) {
+        std::lock_guard<std::mutex> guard(lock);
+        return tree.removeUser(username, disc);
+    }
+    bool retrieveUser(std::string_view username, int disc, Account& found) {
+        std::lock_guard<std::mutex> guard(lock);
+        DNode* user = tree.retrieveUser(username, disc);
+        if (!user) return false;
+        found = user->getAccount();
+        return true;
+    }
+};
+
+bool Tester::checkAVL(UNode* node, int& height){
+    height = -1;
+    if (!node) return true;
+
+    int leftHeight, rightHeight;
+    if (!checkAVL(node->_left, leftHeight) || !checkAVL(node->_right, rightHeight)) return false;
+    if (node->_left && node->_left->getUsername() >= node->getUsername()) return false;
+    if (node->_right && node->_right->getUsername() <= node->getUsername()) return false;
+    int dummySize, dummyVacant;
+    if (!checkCounts(node->_dtree._root, dummySize, dummyVacant)) return false;
+
+    height = (leftHeight > rightHeight ? leftHeight : rightHeight) + 1;
+    if (leftHeight - rightHeight > 1 || rightHeight - leftHeight > 1) return false;
+    return node->getHeight() == height;
+}
+
+bool Tester::checkCounts(DNode* node, int& size, int& numVacant){
+    size = 0;
+    numVacant = 0;
+    if (!node) return true;
+
+    int leftSize, leftVacant, rightSize, rightVacant;
+    if (!checkCounts(node->_left, leftSize, leftVacant) || !checkCounts(node->_right, rightSize, rightVacant)) return false;
+    size = 1 + leftSize + rightSize;
+    numVacant = (node->isVacant() ? 1 : 0) + leftVacant + rightVacant;
+    return node->_size == size && node->_numVacant == numVacant;
+}
+
+/**
+ * Hammers one tree from every thread for a while and then checks nothing got
+ * lost. Every thread owns the discriminators congruent to its index, so it
+ * knows exactly which of its accounts exist and can check every read of its
+ * own; reads of other threads' accounts only have to be consistent.
+ * @param numThreads threads to run at once
+ * @param seconds how long to run for
+ * @return true if every read and the final tree matched what the threads did
+ */
+bool Tester::stressReadersWriters(int numThreads, double seconds){
+    const int numNames = 200, slots = (MAX_DISC - MIN_DISC + 1) / numThreads;
+    ConcurrentUTree tree;
+    std::vector<std::vector<char>> expected(numThreads, std::vector<char>(numNames * slots, 0));
+    std::atomic<bool> failed(false);
+    std::atomic<long> numOps(0);
+    auto stop = std::chrono::steady_clock::now() + std::chrono::duration<double>(seconds);
+
+    UTree::runParallel(numThreads, [&](int t){
+        std::mt19937 threadRng(341 + t);
+        std::uniform_int_distribution<> nameDist(0, numNames - 1), slotDist(0, slots - 1), opDist(0, 99);
+        std::vector<char>& mine = expected[t];
+        long ops = 0;
+        while (std::chrono::steady_clock::now() < stop){
+            for (int i = 0; i < 256; i++, ops++){
+                int n = nameDist(threadRng), slot = slotDist(threadRng), op = opDist(threadRng);
+                int disc = MIN_DISC + slot * numThreads + t;
+                string username = name(n);
+                char& present = mine[n * slots + slot];
+                Account found;
+                if (op < 30){
+                    // a vacant node left by a removal is revived, so only an account that is there is turned down
+                    bool inserted = tree.emplace(username, disc, t % 2, "Subscriber", std::to_string(disc));
+                    if (inserted == bool(present)) failed = true;
+                    present = 1;
+                }else if (op < 55){
+                    if (tree.removeUser(username, disc) != bool(present)) failed = true;
+                    present = 0;
+                }else if (op < 80){
+                    bool exists = tree.retrieveUser(username, disc, found);
+                    if (exists != bool(present) || (exists && found.getStatus() != std::to_string(disc))) failed = true;
+                }else{
+                    // someone else's account, it may come and go but has to be whole when it is there
+                    int other = MIN_DISC + slot * numThreads + (t + 1) % numThreads;
+                    if (tree.retrieveUser(username, other, found) &&
+                        (found.getUsername() != username || found.getStatus() != std::to_string(other))) failed = true;
+                }
+            }
+        }
+        numOps += ops;
+    });
+
+    int height;
+    bool ok = !failed && checkAVL(tree._tree._root, height);
+    for (int n = 0; n < numNames && ok; n++){
+        int count = 0;
+        for (int t = 0; t < numThreads; t++){
+            for (int slot = 0; slot < slots; slot++) count += expected[t][n * slots + slot];
+        }
+        if (tree.numUsers(name(n)) != count) ok = false;
+    }
+    cout << numThreads << " threads: " << numOps << " operations, tree " << (ok ? "intact" : "CORRUPT") << endl;
+    return ok;
+}
+
+/**
+ * Runs operation(tree, thread, rng) on every thread for a while.
+ * @return operations per second across all threads
+ */
+template <class Tree, class Operation>
+double Tester::measure(Tree& tree, int numThreads, double seconds, Operation operation){
+    std::atomic<long> numOps(0);
+    auto start = std::chrono::steady_clock::now();
+    auto stop = start + std::chrono::duration<double>(seconds);
+    UTree::runParallel(numThreads, [&](int t){
+        std::mt19937 threadRng(341 + t);
+        long ops = 0;
+        while (std::chrono::steady_clock::now() < stop){
+            for (int i = 0; i < 256; i++, ops++) operation(tree, t, threadRng);
+        }
+        numOps += ops;
+    });
+    return numOps / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * Prints the throughput of operation on each tree, from 1 thread up to
+ * maxThreads, next to how much it scaled over 1 thread.
+ */
+template <class Operation>
+void Tester::compare(ConcurrentUTree& concurrent, ShardedUTree& sharded, LockedUTree& locked, int maxThreads, double seconds, Operation operation){
+    double concurrentBase = 0.0, shardedBase = 0.0, lockedBase = 0.0;
+    for (int numThreads = 1; numThreads <= maxThreads; numThreads *= 2){
+        double concurrentRate = measure(concurrent, numThreads, seconds, operation);
+        double shardedRate = measure(sharded, numThreads, seconds, operation);
+        double lockedRate = measure(locked, numThreads, seconds, operation);
+        if (numThreads == 1){
+            concurrentBase = concurrentRate;
+            shardedBase = shardedRate;
+            lockedBase = lockedRate;
+        }
+        cout << numThreads << " threads: ConcurrentUTree " << long(concurrentRate) << " ops/s (" << concurrentRate / concurrentBase
+             << "x), ShardedUTree " << long(shardedRate) << " ops/s (" << shardedRate / shardedBase
+             << "x), one mutex " << long(lockedRate) << " ops/s (" << lockedRate / lockedBase << "x)" << endl;
+    }
+}
+
+/**
+ * Compares the throughput of ConcurrentUTree and ShardedUTree against a
+ * UTree behind one mutex, from 1 thread up to maxThreads. Every thread writes only its own
+ * discriminators, so the writes are real inserts and removals.
+ * @param maxThreads most threads to measure with
+ * @param seconds how long every measurement runs
+ * @param writePercent share of the operations that insert or remove
+ */
+void Tester::throughput(int maxThreads, double seconds, int writePercent){
+    ConcurrentUTree concurrent;
+    ShardedUTree sharded;
+    LockedUTree locked;
+    std::vector<AccountRef> accounts;
+    std::vector<string> names;
+    for (int i = 0; i < STRESS_NAMES; i++) names.push_back(name(i));
+    for (const string& username : names){
+        for (int disc = MIN_DISC; disc < MIN_DISC + STRESS_DISCS; disc++) accounts.push_back(AccountRef(username, disc, false, "Subscriber", "status"));
+    }
+    std::vector<AccountRef> copy = accounts, shardedCopy = accounts;
+    concurrent.bulkLoad(accounts);
+    sharded.bulkLoad(shardedCopy);
+    locked.tree.bulkLoad(copy);
+
+    auto operation = [&](auto& tree, int t, std::mt19937& threadRng){
+        std::uniform_int_distribution<> nameDist(0, STRESS_NAMES - 1), opDist(0, 99);
+        const string& username = names[nameDist(threadRng)];
+        Account found;
+        if (opDist(threadRng) >= writePercent){
+            tree.retrieveUser(username, MIN_DISC + nameDist(threadRng) % STRESS_DISCS, found);
+        }else{
+            int disc = MIN_DISC + STRESS_DISCS + t; // only ever touched by this thread
+            if (!tree.removeUser(username, disc)) tree.emplace(username, disc, false, "Subscriber", "status");
+        }
+    };
+
+    cout << "\n" << 100 - writePercent << "% reads, " << writePercent << "% writes:" << endl;
+    compare(concurrent, sharded, locked, maxThreads, seconds, operation);
+}
+
+/**
+ * Measures inserts of usernames that are not in the tree yet, which take the
+ * tree lock of ConcurrentUTree exclusively, against the same comparison as
+ * throughput. Every insert is a new username, no two threads ever pick the same one.
+ * @param maxThreads most threads to measure with
+ * @param seconds how long every measurement runs
+ */
+void Tester::signups(int maxThreads, double seconds){
+    ConcurrentUTree concurrent;
+    ShardedUTree sharded;
+    LockedUTree locked;
+
+    // one counter per thread, each on its own cache line so counting is not what gets measured
+    struct alignas(CACHE_LINE) Counter {long next = 0;};
+    std::vector<Counter> counters(maxThreads);
+    auto operation = [&](auto& tree, int t, std::mt19937&){
+        string username = "new" + std::to_string(t) + "_" + std::to_string(counters[t].next++);
+        tree.emplace(username, MIN_DISC, false, "Subscriber", "status");
+    };
+
+    cout << "\nnew usernames only:" << endl;
+    compare(concurrent, sharded, locked, maxThreads, seconds, operation);
+}
+
+int main(int argc, char** argv) {
+    Tester tester;
+    int maxThreads = argc > 1 ? std::atoi(argv[1]) : std::max(1u, std::thread::hardware_concurrency());
+    double seconds = argc > 2 ? std::atof(argv[2]) : 1.0;
+    if (maxThreads < 1) maxThreads = 1;
+
+    cout << "\nConcurrentUTree: Stress Testing Readers and Writers\n";
+    bool passed = true;
+    for (int numThreads = 2; numThreads <= std::max(2, maxThreads); numThreads *= 2){
+        passed = tester.stressReadersWriters(numThreads, seconds) && passed;
+    }
+    if (passed) cout << "\tTest Passed\n";
+    else cout << "\tTest Failed\n";
+
+    cout << "\nUTree: Measuring shared throughput from 1 to N threads\n";
+    tester.throughput(maxThreads, seconds, 0);
+    tester.throughput(maxThreads, seconds, 10);
+    tester.throughput(maxThreads, seconds, 50); // a signup burst
+    tester.signups(maxThreads, seconds); // and one where every signup is a new username
+    cout << "\n";
+    return passed ? 0 : 1;
+}
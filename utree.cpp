@@ -6,54 +6,447 @@
  */
 
 #include "utree.h"
+#include "cursor.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* A mapped file, unmapped however the function holding it is left */
+struct FileMapping {
+    void* data = nullptr;
+    size_t length = 0;
+
+    ~FileMapping() {if (data) ::munmap(data, length);}
+};
 
 /**
  * Destructor, deletes all dynamic memory.
  */
 UTree::~UTree() {
+    this->closeLog(); // tearing the tree down is not a change worth logging
     this->clear();
 }
 
 /**
  * Sources a .csv file to populate Account objects and insert them into the UTree.
+ * The file is mapped rather than read and parsed in a single pass, every
+ * account is a view into the mapping until it is copied into its DNode.
+ * Lines that cannot be loaded are skipped and reported instead of aborting the load.
+ *
+ * With more than one thread the file is cut into chunks at line boundaries
+ * that are parsed and sorted in parallel. The accounts are then split by
+ * username range, and each thread builds the UNodes and DTrees of its range
+ * out of its own pool before the ranges are joined into one balanced UTree.
  * @param infile path to .csv file containing database of accounts
  * @param append true to append to an existing tree structure or false to clear before importing
- */ 
-void UTree::loadData(string infile, bool append) {
-    std::ifstream instream(infile);
-    string line;
-    char delim = ',';
-    const int numFields = 5;
-    string fields[numFields];
+ * @param numThreads number of threads to load with
+ * @return report of how many lines were read and loaded and why any were rejected
+ */
+LoadReport UTree::loadData(string infile, bool append, int numThreads) {
+    LoadReport report;
+    if(numThreads < 1) numThreads = 1;
 
     /* Check to make sure the file was opened */
-    if(!instream.is_open()) {
-        std::cerr << __FUNCTION__ << ": File " << infile << " could not be opened or located" << endl;
-        exit(-1);
+    int fd = ::open(infile.c_str(), O_RDONLY);
+    struct stat info;
+    if(fd < 0 || ::fstat(fd, &info) < 0) {
+        if(fd >= 0) ::close(fd);
+        report.errors.push_back({0, "file could not be opened or located"});
+        return report;
     }
+    report.opened = true;
 
     /* Should we append or clear? */
     if(!append) this->clear();
 
-    /* Read in the data from the .csv file and insert into the UTree */
-    while(std::getline(instream, line)) {
-        std::stringstream buffer(line);
+    size_t length = info.st_size;
+    const char* data = nullptr;
+    FileMapping mapping;
+    if(length > 0) {
+        void* mapped = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapped == MAP_FAILED) {
+            ::close(fd);
+            report.errors.push_back({0, "file could not be mapped"});
+            return report;
+        }
+        mapping.data = mapped;
+        mapping.length = length;
+        ::madvise(mapped, length, MADV_SEQUENTIAL);
+        data = static_cast<const char*>(mapped);
+    }
+    ::close(fd); // the mapping stays valid on its own
+
+    /* Cut the file into one chunk per thread, each ending right after a newline */
+    std::vector<const char*> bounds(numThreads + 1, data + length);
+    bounds[0] = data;
+    for(int t = 1; t < numThreads; t++) {
+        const char* bound = std::max(bounds[t - 1], data + length / numThreads * t);
+        const char* newline = static_cast<const char*>(std::memchr(bound, '\n', data + length - bound));
+        bounds[t] = newline ? newline + 1 : data + length;
+    }
+
+    std::vector<std::vector<AccountRef>> chunks(numThreads);
+    std::vector<LoadReport> chunkReports(numThreads);
+    runParallel(numThreads, [&](int t){
+        parseChunk(bounds[t], bounds[t + 1], chunks[t], chunkReports[t]);
+        std::stable_sort(chunks[t].begin(), chunks[t].end(), accountLess);
+    });
+
+    /* Line numbers restart at every chunk, shift them to where the chunk starts */
+    for(int t = 0; t < numThreads; t++) {
+        for(LoadError error : chunkReports[t].errors) {
+            error.line += report.lines;
+            report.errors.push_back(error);
+        }
+        report.lines += chunkReports[t].lines;
+        report.parsed += chunks[t].size();
+    }
+
+    if(numThreads == 1) {
+        report.loaded = this->bulkLoadHelper(chunks[0]);
+    } else {
+        report.loaded = parallelLoad(chunks);
+    }
+
+    if(_log.isOpen()) checkpoint(); // one snapshot beats logging every account of the file
+    return report;
+}
+
+/**
+ * Inserts many accounts at once. The accounts are sorted by username and
+ * discriminator, merged with whatever the tree already holds, and every
+ * UTree and DTree is then built balanced from the bottom up, so past the
+ * sort the load is linear instead of one AVL descent per account.
+ * @param accounts accounts to be inserted, sorted in place
+ * @return number of accounts inserted, rejected and taken discriminators are skipped like insert would
+ */
+int UTree::bulkLoad(std::vector<AccountRef>& accounts) {
+    int inserted = bulkLoadHelper(accounts);
+    if (_log.isOpen()) checkpoint(); // one snapshot beats logging every account
+    return inserted;
+}
+
+int UTree::bulkLoadHelper(std::vector<AccountRef>& accounts){
+    // stable so that when a discriminator repeats, the account that came first is the one kept
+    std::stable_sort(accounts.begin(), accounts.end(), accountLess);
+
+    std::vector<UNode*> existing;
+    flattenTraverse(this->_root, existing);
+    this->_root = nullptr;
+
+    std::vector<UNode*> nodes;
+    int inserted;
+    try {
+        inserted = mergeAccounts(accounts.data(), accounts.size(), existing.data(), existing.size(), _pool, nodes);
+    } catch (...) {
+        restoreExisting(existing); // the accounts the tree already had are never lost to a failed load
+        throw;
+    }
+    this->_root = buildTraverse(nodes, 0, nodes.size());
+    return inserted;
+}
+
+int UTree::parallelLoad(std::vector<std::vector<AccountRef>>& chunks){
+    int numThreads = chunks.size();
+
+    // splitters are picked from a sample of every sorted chunk so the ranges come out about even
+    std::vector<std::string_view> sample;
+    for (const std::vector<AccountRef>& chunk : chunks){
+        for (int k = 1; k <= numThreads && !chunk.empty(); k++){
+            sample.push_back(chunk[chunk.size() * k / (numThreads + 1)].username);
+        }
+    }
+    std::sort(sample.begin(), sample.end());
+    std::vector<std::string_view> splitters;
+    for (int t = 1; t < numThreads && !sample.empty(); t++) splitters.push_back(sample[sample.size() * t / numThreads]);
+
+    std::vector<UNode*> existing;
+    flattenTraverse(this->_root, existing);
+    this->_root = nullptr;
+
+    // finds where a username range starts, splitting by username alone keeps every DTree in one range
+    auto rangeStart = [&](int t, auto begin, auto end, auto username){
+        if (t == 0) return begin;
+        if (t > (int) splitters.size()) return end;
+        return std::lower_bound(begin, end, splitters[t - 1], [&](const auto& item, std::string_view key){
+            return username(item) < key;
+        });
+    };
+    auto accountName = [](const AccountRef& account){return account.username;};
+    auto nodeName = [](UNode* node){return node->getUsername();};
+
+    std::vector<std::vector<UNode*>> ranges(numThreads);
+    std::vector<NodePool> pools(numThreads);
+    std::vector<int> inserted(numThreads);
+    try {
+        runParallel(numThreads, [&](int t){
+            // every chunk holds a sorted slice of this range, stable sorting them in chunk order keeps the file order on ties
+            std::vector<AccountRef> accounts;
+            for (std::vector<AccountRef>& chunk : chunks){
+                auto first = rangeStart(t, chunk.begin(), chunk.end(), accountName);
+                auto last = rangeStart(t + 1, chunk.begin(), chunk.end(), accountName);
+                accounts.insert(accounts.end(), first, last);
+            }
+            std::stable_sort(accounts.begin(), accounts.end(), accountLess);
+
+            auto first = rangeStart(t, existing.begin(), existing.end(), nodeName);
+            auto last = rangeStart(t + 1, existing.begin(), existing.end(), nodeName);
+            inserted[t] = mergeAccounts(accounts.data(), accounts.size(), existing.data() + (first - existing.begin()), last - first, pools[t], ranges[t]);
+        });
+    } catch (...) {
+        // nodes the threads made may already hang off an existing DTree, so their pools have to stay around
+        for (NodePool& pool : pools) _pool.merge(pool);
+        restoreExisting(existing);
+        throw;
+    }
+
+    // the ranges are sorted and disjoint, so joining them is just putting them back to back
+    std::vector<UNode*> nodes;
+    int total = 0;
+    for (int t = 0; t < numThreads; t++){
+        nodes.insert(nodes.end(), ranges[t].begin(), ranges[t].end());
+        _pool.merge(pools[t]);
+        total += inserted[t];
+    }
+    this->_root = buildTraverse(nodes, 0, nodes.size());
+    return total;
+}
+
+void UTree::restoreExisting(std::vector<UNode*>& existing){
+    for (UNode * node : existing) node->getDTree()->_pool = &_pool;
+    this->_root = buildTraverse(existing, 0, existing.size());
+}
+
+int UTree::mergeAccounts(const AccountRef* accounts, size_t numAccounts, UNode* const* existing, size_t numExisting,
+                         NodePool& pool, std::vector<UNode*>& nodes){
+    // merge the existing usernames with the incoming ones, both sorted
+    nodes.reserve(numExisting);
+    size_t next = 0;
+    size_t i = 0;
+    int inserted = 0;
+    while (i < numAccounts || next < numExisting){
+        if (i == numAccounts || (next < numExisting && existing[next]->getUsername() < accounts[i].username)){
+            nodes.push_back(existing[next++]);
+            continue;
+        }
+
+        // every account of one username goes into its DTree in one go
+        size_t end = i + 1;
+        while (end < numAccounts && accounts[end].username == accounts[i].username) end++;
+
+        UNode * node;
+        if (next < numExisting && existing[next]->getUsername() == accounts[i].username) node = existing[next++];
+        else node = makeUNode(accounts[i].username, pool);
+
+        // the DTree allocates out of the given pool for now, which may be private to this thread
+        DTree * dtree = node->getDTree();
+        dtree->_pool = &pool;
+        inserted += dtree->bulkLoad(accounts + i, end - i);
+        i = end;
+
+        if (dtree->getNumUsers() == 0){ // every account was rejected
+            freeUNode(node, pool);
+            continue;
+        }
+        dtree->_pool = &_pool;
+        nodes.push_back(node);
+    }
+    return inserted;
+}
 
-        /* Quick check to make sure each line is formatted correctly */
-        int delimCount = 0;
-        for(unsigned int c = 0; c < buffer.str().length(); c++) if(buffer.str()[c] == delim) delimCount++;
-        if(delimCount != numFields - 1) {
-            throw std::invalid_argument("Malformed input file detected - ensure each line contains 5 fields deliminated by a ','");
+void UTree::parseChunk(const char* begin, const char* end, std::vector<AccountRef>& accounts, LoadReport& report){
+    const char delim = ',';
+    const int numFields = 5;
+    std::string_view fields[numFields];
+
+    accounts.reserve((end - begin) / 32); // a rough guess at the line count saves most of the regrowth
+
+    const char* cursor = begin;
+    while(cursor < end) {
+        const char* newline = static_cast<const char*>(std::memchr(cursor, '\n', end - cursor));
+        if(!newline) newline = end;
+        std::string_view line(cursor, newline - cursor);
+        cursor = newline + 1;
+        report.lines++;
+
+        if(!line.empty() && line.back() == '\r') line.remove_suffix(1); // exported on windows
+        if(line.empty()) continue;
+
+        /* Split the line into its 5 fields in one pass, the status is whatever is left */
+        int count = 0;
+        size_t start = 0;
+        for(size_t c = 0; c < line.size() && count < numFields - 1; c++) {
+            if(line[c] != delim) continue;
+            fields[count++] = line.substr(start, c - start);
+            start = c + 1;
+        }
+        fields[count++] = line.substr(start);
+        if(count != numFields || fields[numFields - 1].find(delim) != std::string_view::npos) {
+            report.errors.push_back({report.lines, "line does not have 5 comma separated fields"});
+            continue;
         }
 
-        /* Populate the account attributes - 
-         * Each line always has 5 sections of data */
-        for(int i = 0; i < numFields; i++) {
-            std::getline(buffer, line, delim);
-            fields[i] = line;
+        int disc, nitro;
+        if(!parseInt(fields[1], disc)) {
+            report.errors.push_back({report.lines, "discriminator is not a number"});
+            continue;
+        }
+        if(disc < MIN_DISC || disc > MAX_DISC) {
+            report.errors.push_back({report.lines, "discriminator out of valid range"});
+            continue;
+        }
+        if(!parseInt(fields[2], nitro)) {
+            report.errors.push_back({report.lines, "nitro is not a number"});
+            continue;
+        }
+        if(fields[0].empty()) {
+            report.errors.push_back({report.lines, "username is empty"});
+            continue;
         }
-        Account newAcct = Account(fields[0], std::stoi(fields[1]), std::stoi(fields[2]), fields[3], fields[4]);
-        this->insert(newAcct);
+        if(fields[4].size() > MAX_STATUS_LENGTH) {
+            report.errors.push_back({report.lines, "status is too long"});
+            continue;
+        }
+        if(BadgeTable::intern(fields[3]) == INVALID_BADGE) {
+            report.errors.push_back({report.lines, "badge is new and the badge table is full"});
+            continue;
+        }
+        accounts.emplace_back(fields[0], disc, nitro != 0, fields[3], fields[4]);
+    }
+}
+
+/**
+ * Parses a whole field as a base 10 integer, without copying it.
+ * @param field text of the field
+ * @param value set to the parsed integer
+ * @return true if the field held nothing but an integer that fits in an int
+ */
+bool UTree::parseInt(std::string_view field, int& value) {
+    const char* first = field.data();
+    const char* last = field.data() + field.size();
+    if(first != last && *first == '+') first++; // from_chars does not take a leading plus
+    std::from_chars_result result = std::from_chars(first, last, value);
+    return result.ec == std::errc() && result.ptr == last && first != last;
+}
+
+bool UTree::accountLess(const AccountRef& a, const AccountRef& b){
+    int compare = a.username.compare(b.username);
+    return compare < 0 || (compare == 0 && a.disc < b.disc);
+}
+
+void UTree::runParallel(int numThreads, const std::function<void(int)>& task){
+    // an exception cannot leave a thread, so the first one thrown is carried over and rethrown here
+    std::vector<std::exception_ptr> errors(numThreads);
+    auto guarded = [&](int t){
+        try {
+            task(t);
+        } catch (...) {
+            errors[t] = std::current_exception();
+        }
+    };
+
+    // the calling thread takes the first share instead of sitting idle
+    std::vector<std::thread> threads;
+    for (int t = 1; t < numThreads; t++) threads.emplace_back(guarded, t);
+    guarded(0);
+    for (std::thread& thread : threads) thread.join();
+
+    for (std::exception_ptr& error : errors) if (error) std::rethrow_exception(error);
+}
+
+/**
+ * Makes every change to the tree durable from now on. The tree is replaced
+ * by the snapshot at snapshotPath, and every change in the log at logPath
+ * that the snapshot does not hold yet is replayed on top of it. From then on
+ * each insert and removal is appended to the log before it returns, and
+ * checkpoint folds the log back into the snapshot.
+ * When there is neither a snapshot nor a log yet, the tree as it is becomes
+ * the first checkpoint instead.
+ * @param snapshotPath snapshot the log starts from, written by every checkpoint
+ * @param logPath file to log changes to
+ * @param syncEvery number of changes that may be lost in a crash, 1 loses none and 0 leaves it to syncLog
+ * @return true if the tree was recovered and the log is open
+ */
+bool UTree::openLog(const string& snapshotPath, const string& logPath, int syncEvery) {
+    closeLog();
+
+    struct stat info;
+    bool hasSnapshot = ::stat(snapshotPath.c_str(), &info) == 0;
+    bool hasLog = ::stat(logPath.c_str(), &info) == 0 && info.st_size > 0;
+    if (hasSnapshot){
+        if (!loadSnapshot(snapshotPath)) return false;
+    }else if (hasLog){
+        clear(); // the log was started from an empty tree
+        _sequence = 0; // clear counted itself as a change, the log's first record is still to be replayed
+    }
+
+    uint64_t base = _sequence;
+    bool opened = _log.open(logPath, syncEvery, [&](const LogRecord& record){
+        if (record.sequence <= base) return; // a checkpoint got these in before the log was cut
+        replayOperation(record);
+        // concurrent writers may have logged sequence numbers out of order
+        if (record.sequence > _sequence) _sequence = record.sequence;
+    });
+    if (!opened) return false;
+
+    _snapshotPath = snapshotPath;
+    if (!hasSnapshot) return checkpoint();
+    return true;
+}
+
+/**
+ * Writes the whole tree to the log's snapshot and empties the log.
+ * @return true if the checkpoint was written
+ */
+bool UTree::checkpoint() {
+    if (!_log.isOpen()) return false;
+
+    // the snapshot goes in place before the log is cut, a crash in between only makes the replay skip records
+    if (!_log.sync() || !saveSnapshot(_snapshotPath)) return false;
+    return _log.truncate();
+}
+
+/**
+ * Makes every change logged so far durable. Changes are applied to the tree
+ * even if logging them fails, this is where that shows.
+ * @return true if every logged change is on disk
+ */
+bool UTree::syncLog() {
+    return _log.sync();
+}
+
+/**
+ * Makes every logged change durable and stops logging.
+ */
+void UTree::closeLog() {
+    _log.close();
+}
+
+void UTree::logOperation(LogOp op, const AccountRef& account){
+    uint64_t ticket = logEnqueue(op, account);
+    if (ticket && _logWaits) _log.wait(ticket);
+}
+
+uint64_t UTree::logEnqueue(LogOp op, const AccountRef& account){
+    uint64_t sequence = ++_sequence;
+    if (!_log.isOpen()) return 0;
+
+    LogRecord record = {sequence, op, account.username, account.disc, account.nitro, account.badge, account.status};
+    return _log.enqueue(record);
+}
+
+void UTree::replayOperation(const LogRecord& record){
+    switch (record.op){
+    case LOG_INSERT:
+        emplace(record.username, record.disc, record.nitro, record.badge, record.status);
+        break;
+    case LOG_REMOVE:
+        removeUser(record.username, record.disc);
+        break;
+    case LOG_CLEAR:
+        clear();
+        break;
     }
 }
 
@@ -64,75 +457,211 @@ void UTree::loadData(string infile, bool append) {
  * @param newAcct Account object to be inserted into the corresponding DTree
  * @return true if the account was inserted, false otherwise
  */
-bool UTree::insert(Account newAcct) {
-    insertHelper(newAcct, this->_root);
+bool UTree::insert(const Account& newAcct) {
+    DNode* inserted = nullptr;
+    AccountRef account(newAcct);
+    insertHelper(account, this->_root, inserted);
+    if (inserted) logOperation(LOG_INSERT, account);
+    return inserted != nullptr;
+}
 
-    if (retrieve(newAcct.getUsername())->getUsername() == newAcct.getUsername()) return true;
-    return false;
+/**
+ * Inserts an account built straight from its fields, which are copied into
+ * the new DNode and nowhere else.
+ * @return true if the account was inserted, false otherwise
+ */
+bool UTree::emplace(std::string_view username, int disc, bool nitro, std::string_view badge, std::string_view status) {
+    DNode* inserted = nullptr;
+    AccountRef account(username, disc, nitro, badge, status);
+    insertHelper(account, this->_root, inserted);
+    if (inserted) logOperation(LOG_INSERT, account);
+    return inserted != nullptr;
 }
 
-void UTree::insertHelper(Account newAcct, UNode *& node){
-    if (!this->_root){ // create a URoot if there isnt one there
-        UNode * bruh = new UNode();
-        this->_root = bruh;
-        bruh->getDTree()->insert(newAcct);
-        updateHeight(node);
+void UTree::insertHelper(const AccountRef& account, UNode *& node, DNode *& inserted){
+    if (!node){ // new username, its DTree starts out with this account
+        if (account.disc < MIN_DISC || account.disc > MAX_DISC) return;
+        node = makeUNode(account.username);
+        node->getDTree()->emplace(account, inserted);
+        if (!inserted){ // the DTree turned the account down, so the username stays out
+            freeUNode(node);
+            node = nullptr;
+        }
+        return;
+    }
+
+    int compare = account.username.compare(node->getUsername());
+    if (compare < 0){ // traverse based on the string
+        insertHelper(account, node->_left, inserted);
+    }else if (compare > 0){
+        insertHelper(account, node->_right, inserted);
+    }else{
+        node->getDTree()->emplace(account, inserted); // existing username, heights dont change
+        return;
     }
 
+    updateHeight(node);
+    node = rebalance(node);
+}
+
+/**
+ * Picks a free discriminator for the account's username and inserts the account with it.
+ * The discriminator the account was created with is ignored.
+ * @param newAcct Account object to be inserted, its discriminator is overwritten
+ * @param policy LOWEST_FREE for the smallest free discriminator, RANDOM_FREE for a uniformly random one
+ * @param rng random number generator used by RANDOM_FREE
+ * @return the discriminator the account got, INVALID_DISC if the username has none left
+ */
+int UTree::allocateDiscriminator(const Account& newAcct, AllocPolicy policy, std::mt19937& rng) {
+    UNode* node = retrieve(newAcct.getUsername());
+    AccountRef account(newAcct);
+    DNode* inserted = nullptr;
+
     if (node){
+        account.disc = node->getDTree()->findFree(policy, rng);
+        if (account.disc == INVALID_DISC) return INVALID_DISC;
+        node->getDTree()->emplace(account, inserted);
+    }else{
+        // a new username has every discriminator free
+        if (policy == LOWEST_FREE) account.disc = MIN_DISC;
+        else account.disc = std::uniform_int_distribution<>(MIN_DISC, MAX_DISC)(rng);
+        insertHelper(account, this->_root, inserted);
+    }
 
-        if (newAcct.getUsername() < node->getUsername()){ // traverse based on the string
-            if (node->_left){   
-                insertHelper(newAcct, node->_left);
-                updateHeight(node);
-                // if (node->_left) node->_left = rebalance(node->_left);
-                // if (node->_right) node->_right = rebalance(node->_right);
-                node = rebalance(node);
-                updateHeight(node);
+    if (!inserted) return INVALID_DISC;
+    logOperation(LOG_INSERT, account); // logged with the discriminator it got, so a replay needs no rng
+    return account.disc;
+}
 
-            }else{
-                UNode * bruh = new UNode();
-                node->_left = bruh;
-                bruh->getDTree()->insert(newAcct);
-                updateHeight(node);
+/**
+ * Inserts a batch of accounts with one pass over the tree. The batch is
+ * sorted by username and discriminator and split around every UNode on the
+ * way down, so every UNode and every DTree the batch touches is visited once,
+ * see DTree::insertBatch. New usernames go in as balanced subtrees and heights
+ * are only fixed on the way back up, once per UNode for the whole batch.
+ * @param accounts accounts to be inserted, in any order
+ * @param count number of accounts
+ * @param results set to whether each account was inserted, in the order of accounts;
+ *        when a username and discriminator repeat, only the first one can be
+ * @return number of accounts inserted
+ */
+int UTree::insertBatch(const Account* accounts, size_t count, std::vector<bool>& results) {
+    std::vector<AccountRef> batch;
+    batch.reserve(count);
+    for (size_t i = 0; i < count; i++) batch.push_back(AccountRef(accounts[i]));
+    return applyBatch(batch, LOG_INSERT, results);
+}
 
-        
-            }
-            
-        }
-        if (newAcct.getUsername() > node->getUsername()){ // traverse based on the string
-            if (node->_right){
-                insertHelper(newAcct, node->_right);
-                updateHeight(node);
-                node = rebalance(node);
-                updateHeight(node);
+/**
+ * Removes a batch of users with one pass over the tree, see insertBatch.
+ * Like removeUser, a username whose last account goes loses its UNode.
+ * @param users usernames and discriminators to be removed, in any order
+ * @param count number of users
+ * @param results set to whether each user was removed, in the order of users;
+ *        a user that is not there, or was already removed, gets false
+ * @return number of users removed
+ */
+int UTree::removeBatch(const std::pair<std::string_view, int>* users, size_t count, std::vector<bool>& results) {
+    std::vector<AccountRef> batch;
+    batch.reserve(count);
+    for (size_t i = 0; i < count; i++) batch.push_back(AccountRef(users[i].first, users[i].second, false, "", ""));
+    return applyBatch(batch, LOG_REMOVE, results);
+}
 
-            }else{
-                UNode * bruh = new UNode();
-                node->_right= bruh;
-                bruh->getDTree()->insert(newAcct);
-                updateHeight(node);
+int UTree::applyBatch(std::vector<AccountRef>& batch, LogOp op, std::vector<bool>& results){
+    // stable so that when a user repeats, the one that came first in the batch is the one done
+    std::vector<size_t> order(batch.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b){return accountLess(batch[a], batch[b]);});
+
+    std::vector<AccountRef> sorted;
+    std::vector<int> discs;
+    sorted.reserve(batch.size());
+    discs.reserve(batch.size());
+    for (size_t index : order){
+        sorted.push_back(batch[index]);
+        discs.push_back(batch[index].disc);
+    }
 
+    std::unique_ptr<bool[]> done(new bool[sorted.size()]());
+    int total = 0;
+    if (op == LOG_INSERT) insertBatchHelper(this->_root, sorted.data(), done.get(), sorted.size(), total);
+    else removeBatchHelper(this->_root, sorted.data(), discs.data(), done.get(), sorted.size(), total);
+
+    // logged in sorted order, which replays to the same accounts, and waited on once for the whole batch
+    results.assign(batch.size(), false);
+    uint64_t ticket = 0;
+    for (size_t i = 0; i < sorted.size(); i++){
+        if (!done[i]) continue;
+        results[order[i]] = true;
+        ticket = logEnqueue(op, sorted[i]);
+    }
+    if (ticket && _logWaits) _log.wait(ticket);
+    return total;
+}
 
-                
+void UTree::insertBatchHelper(UNode *& node, const AccountRef* accounts, bool* done, size_t count, int& inserted){
+    if (count == 0) return;
+
+    if (!node){ // none of these usernames are in the tree, they go in as a balanced subtree of their own
+        std::vector<UNode*> nodes;
+        size_t lo, hi;
+        for (size_t i = 0; i < count; i = hi){
+            splitBatch(accounts + i, count - i, accounts[i].username, lo, hi);
+            hi += i;
+            UNode * fresh = makeUNode(accounts[i].username);
+            int added = fresh->getDTree()->insertBatch(accounts + i, hi - i, done + i);
+            if (added){
+                nodes.push_back(fresh);
+                inserted += added;
+            }else{
+                freeUNode(fresh); // nothing of it could be inserted, so the username stays out
             }
         }
+        node = buildTraverse(nodes, 0, nodes.size());
+        return;
+    }
 
-        if (newAcct.getUsername() == node->getUsername()){
-            node->getDTree()->insert(newAcct);
-            updateHeight(node);
-        }
-        
+    // [0, lo) goes left, [lo, hi) belongs to this UNode, [hi, count) goes right
+    size_t lo, hi;
+    splitBatch(accounts, count, node->getUsername(), lo, hi);
+    insertBatchHelper(node->_left, accounts, done, lo, inserted);
+    if (hi > lo) inserted += node->getDTree()->insertBatch(accounts + lo, hi - lo, done + lo);
+    insertBatchHelper(node->_right, accounts + hi, done + hi, count - hi, inserted);
+    settleBatch(node);
+}
 
-    }
+void UTree::removeBatchHelper(UNode *& node, const AccountRef* users, const int* discs, bool* done, size_t count, int& removed){
+    if (count == 0 || !node) return; // whatever is left of the batch is not in the tree
 
-    
-    updateHeight(node);
+    size_t lo, hi;
+    splitBatch(users, count, node->getUsername(), lo, hi);
+    removeBatchHelper(node->_left, users, discs, done, lo, removed);
+    if (hi > lo) removed += node->getDTree()->removeBatch(discs + lo, hi - lo, done + lo);
+    removeBatchHelper(node->_right, users + hi, discs + hi, done + hi, count - hi, removed);
 
-    if (node && node == _root) _root = rebalance(_root);
-    
-    
+    if (hi > lo && node->getDTree()->getNumUsers() == 0) unlinkUNode(node); // the batch took its last account
+    if (node) settleBatch(node);
+}
 
+void UTree::settleBatch(UNode *& node){
+    updateHeight(node);
+    int balance = checkImbalance(node);
+    if (balance == 2 || balance == -2){
+        node = rebalance(node); // both sides are balanced already, so rotating is enough
+    }else if (balance > 2 || balance < -2){
+        // a batch can tip a subtree further than rotations fix, so it is built again instead
+        std::vector<UNode*> nodes;
+        flattenTraverse(node, nodes);
+        node = buildTraverse(nodes, 0, nodes.size());
+    }
+}
+
+void UTree::splitBatch(const AccountRef* accounts, size_t count, std::string_view username, size_t& lo, size_t& hi){
+    lo = std::lower_bound(accounts, accounts + count, username,
+                          [](const AccountRef& a, std::string_view u){return a.username < u;}) - accounts;
+    hi = std::upper_bound(accounts + lo, accounts + count, username,
+                          [](std::string_view u, const AccountRef& a){return u < a.username;}) - accounts;
 }
 
 UNode * UTree::left(UNode * a){ // rotates the subtree to the right
@@ -142,8 +671,8 @@ UNode * UTree::left(UNode * a){ // rotates the subtree to the right
     a->_right = c;
 
 
+    updateHeight(a); // a is now below b, so it has to be updated first
     updateHeight(b);
-    updateHeight(a);
     
     return b;
 }
@@ -155,8 +684,8 @@ UNode * UTree::right(UNode * a){ // rotates the subtree to the right
     b->_right = a;
     a->_left = c;
 
+    updateHeight(a); // a is now below b, so it has to be updated first
     updateHeight(b);
-    updateHeight(a);
     
     
 
@@ -165,237 +694,86 @@ UNode * UTree::right(UNode * a){ // rotates the subtree to the right
 
 
 /**
- * Removes a user with a matching username and discriminator.
+ * Removes a user with a matching username and discriminator. A username goes
+ * with its last account, its UNode is unlinked and the path back up rebalanced.
  * @param username username to match
  * @param disc discriminator to match
- * @param removed DNode object to hold removed account
  * @return true if an account was removed, false otherwise
  */
-bool UTree::removeUser(string username, int disc, DNode*& removed) {
-    
-
-    bool populated; // this boolean will change how we evaluate whether the DNode or UNode was removed
-    if (!retrieve(username)) {// node has to be in the tree to be removed
-
-        return false; 
-
-    }
-
-    if (!retrieveUser(username, disc)) {
-
-        return false;
-
-    }
-
-    if (numUsers(retrieve(username))) populated = true;
-    else populated = false;
-    
-
+bool UTree::removeUser(std::string_view username, int disc) {
+    return removeAccount(username, disc, nullptr);
+}
 
-    if (username == this->_root->getUsername()){ // case to check root
-        if(numUsers(this->_root)){
-            this->_root->getDTree()->remove(disc, removed);
-        }else{
-            if (isLeaf(_root)){
-                delete _root;
-                _root = nullptr;
-            }
-            else{
-                cout << "yes" << endl;
-                UNode * x = rootSearch(_root); // save the node that will replace the old node
-                cout << x->getUsername() << endl;
-                UNode * y = _root->_left; // save the left and right of the node to be deleted
-                UNode * z = _root->_right;
-
-                x->_left = y; // set the left and right of the node that will replace it
-                x->_right = z;
-                delete _root; // deallocate old node
-                _root = x; // set the current nodes left to the new replacement
-                updateHeight(_root);
-                updateLeftHeights(_root->_left);
-                cout << "no" << endl;
-            }            
-        }
+/**
+ * Removes a user with a matching username and discriminator and hands back its
+ * account, see DTree::remove. The strings are copied out, which can allocate.
+ * @param username username to match
+ * @param disc discriminator to match
+ * @param removed set to a copy of the removed account, left alone if nothing was removed
+ * @return true if an account was removed, false otherwise
+ */
+bool UTree::removeUser(std::string_view username, int disc, Account& removed) {
+    return removeAccount(username, disc, &removed);
+}
 
-    }else{
-        removeHelper(username, disc, this->_root, removed); // if the root isnt the one we are deleting, then we go on an adventure through the tree to find it
-    }
+bool UTree::removeAccount(std::string_view username, int disc, Account* removed) {
+    UNode * node = retrieve(username);
+    if (!node || !node->getDTree()->removeAccount(disc, removed)) return false;
+    if (node->getDTree()->getNumUsers() == 0) pruneUNode(username); // its last account went, so the username goes too
 
-    if (populated){
-        if (!retrieveUser(username, disc) || retrieveUser(username, disc)->isVacant()){ //THESE WORK, WHAT WE DONT HAVE IS A VACANCY CHECK IN DTREE
-            return true;
-        }else{
-            return false;
-        }
-    }else{
-        if (retrieve(username)) {
-            return false;
-        }
-    }
+    logOperation(LOG_REMOVE, AccountRef(username, disc, false, "", ""));
     return true;
 }
 
-void UTree::removeHelper(string username, int disc, UNode * node, DNode *& removed){
-    if (node){
-        // check if unode is empty here or not
-        if (node->_left){ 
-                if (username == node->_left->getUsername()){
-                    if(numUsers(node->_left)){
-                        node->_left->getDTree()->remove(disc, removed);
-
-                        return;
-                    }
-                    if (isLeaf(node->_left)){
-                        delete node->_left;
-                        node->_left = nullptr;
-                        updateHeight(node);
-                        return;
-
-                    }
-                    else if(oneSubtree(node->_left) == 1){ // left of the node to be removed exists but right doesnt
-                       
-                        UNode * next = node->_left->_left;
-                            
-                        delete node->_left;
-
-                        node->_left = next;
-                        updateHeight(node);
-
-                        return;
-
-
-                    }
-                    else if(oneSubtree(node->_left) == 2){ // right of the node to be removed exists but left doesnt
-                        UNode * next = node->_left->_right;
-                            
-                        delete node->_left;
-
-                        node->_left = next;
-                        updateHeight(node);
-
-
-                        return;
-                    }
-                    else{
-                        UNode * x = rootSearch(node->_left); // save the node that will replace the old node
-                        UNode * y = node->_left->_left; // save the left and right of the node to be deleted
-                        UNode * z = node->_left->_right;
-
-
-                        x->_left = y; // set the left and right of the node that will replace it
-                        x->_right = z;
-                        delete node->_left; // deallocate old node
-                        node->_left = x; // set the current nodes left to the new replacement
-                        updateHeight(node->_left);
-                        updateHeight(node);
-                        return;
-
-                    }
-                        
-                }
-
-
-
-        } if (node->_right){ // repeat the check but for right node
-            if (username == node->_right->getUsername()){
-                if(numUsers(node->_right)){
-                    node->_right->getDTree()->remove(disc, removed);
-                    return;
-                }
-                if (isLeaf(node->_right)){
-                    delete node->_right;
-                    node->_right = nullptr;
-                    updateHeight(node);
-                    return;
-
-                }
-                else if(oneSubtree(node->_right) == 1){ // left of the node to be removed exists but right doesnt
-                       
-                    UNode * next = node->_right->_left;
-                            
-                    delete node->_right;
-
-                    node->_right = next;
-                    updateHeight(node);
-
-                    
-                    return;
-
-
-                }
-                else if(oneSubtree(node->_right) == 2){ // right of the node to be removed exists but left doesnt
-                    UNode * next = node->_right->_right;
-                            
-                    delete node->_right;
-
-                    node->_right = next;
-                    updateHeight(node);
-                    return;
-                }
-                else{
-                    UNode * x = rootSearch(node->_right); // save the node that will replace the old node
-                    UNode * y = node->_right->_left; // save the left and right of the node to be deleted
-                    UNode * z = node->_right->_right;
-
-
-                    x->_left = y; // set the left and right of the node that will replace it
-                    x->_right = z;
-                    delete node->_right; // deallocate old node
-                    node->_right = x; // set the current nodes right to the new replacement
-                    updateHeight(node->_right);
-                    updateHeight(node);
-                    node->_right = rebalance(node->_right);
-                    return;
-
-                }
-                        
-            }
-
-            
-        }
+bool UTree::pruneUNode(std::string_view username){
+    bool pruned = false;
+    pruneHelper(username, this->_root, pruned);
+    return pruned;
+}
 
-        
+void UTree::pruneHelper(std::string_view username, UNode *& node, bool& pruned){
+    if (!node) return;
 
-        removeHelper(username, disc, node->_left, removed);
-        removeHelper(username, disc, node->_right, removed);
-        return;
+    int compare = username.compare(node->getUsername());
+    if (compare < 0){
+        pruneHelper(username, node->_left, pruned);
+    }else if (compare > 0){
+        pruneHelper(username, node->_right, pruned);
+    }else if (node->getDTree()->getNumUsers() == 0){
+        unlinkUNode(node);
+        pruned = true;
     }
-}
 
-void UTree::updateLeftHeights(UNode* node){
-    if (!node) return;
-    updateLeftHeights(node->_left);
-    updateLeftHeights(node->_right);
+    if (!pruned || !node) return; // nothing below changed, so neither did the heights
     updateHeight(node);
+    node = rebalance(node);
 }
 
-UNode * UTree::rootSearch(UNode * node){
-    if(oneSubtree(node)){
-        if (node->_right) return node->_right;
-        else return node->_left;
+void UTree::unlinkUNode(UNode *& node){
+    UNode * empty = node;
+    if (!empty->_left){
+        node = empty->_right;
+    }else if (!empty->_right){
+        node = empty->_left;
     }else{
-        UNode * replacementDad = findLowestParent(node); // second lowest node in the subtree
-        UNode * replacementRoot = replacementDad->_left;
-        replacementDad->_left = nullptr; // we have to disconnect the node from its parent so that its parent wont point back to the root
-        return replacementRoot;        
+        node = detachMin(empty->_right); // the next username takes its place
+        node->_left = empty->_left;
+        node->_right = empty->_right;
     }
-
-}
-
-UNode * UTree::findLowestParent(UNode * node){
-    if (node->_left && !node->_left->_left) return node;
-    return findLowestParent(node->_left);
+    freeUNode(empty);
 }
 
-bool UTree::isLeaf(UNode* node){
-    if (!node->_left && !node->_right) return true;
-    return false;
-}
+UNode * UTree::detachMin(UNode *& node){
+    if (!node->_left){
+        UNode * min = node;
+        node = node->_right;
+        return min;
+    }
 
-int UTree::oneSubtree(UNode * node){
-    if (node->_right && !node->_left) return 2;
-    if (node->_left && !node->_right) return 1;
-    return 0;
+    UNode * min = detachMin(node->_left);
+    updateHeight(node);
+    node = rebalance(node);
+    return min;
 }
 
 /**
@@ -403,17 +781,18 @@ int UTree::oneSubtree(UNode * node){
  * @param username username to match
  * @return UNode with a matching username, nullptr otherwise
  */
-UNode* UTree::retrieve(string username) {
+UNode* UTree::retrieve(std::string_view username) {
     return retrieveHelper(username, this->_root);
 }
 
-UNode * UTree::retrieveHelper(string username, UNode * node){
+UNode * UTree::retrieveHelper(std::string_view username, UNode * node){
 
     if (node){
-        if (node->getUsername() == username){
+        int compare = username.compare(node->getUsername());
+        if (compare == 0){
             return node;
         }else{
-            if (username < node->getUsername()) return retrieveHelper(username, node->_left);
+            if (compare < 0) return retrieveHelper(username, node->_left);
             else return retrieveHelper(username, node->_right);
         }
     }else{
@@ -429,16 +808,17 @@ UNode * UTree::retrieveHelper(string username, UNode * node){
  * @param disc discriminator to match
  * @return DNode with a matching username and discriminator, nullptr otherwise
  */
-DNode* UTree::retrieveUser(string username, int disc) {
+DNode* UTree::retrieveUser(std::string_view username, int disc) {
     return retrieveUserHelper(username, disc, this->_root);
 }
 
-DNode* UTree::retrieveUserHelper(string username, int disc, UNode * node){
+DNode* UTree::retrieveUserHelper(std::string_view username, int disc, UNode * node){
     if (node){
-        if (node->getUsername() == username){
+        int compare = username.compare(node->getUsername());
+        if (compare == 0){
             return node->getDTree()->retrieve(disc);
         }else{
-            if (username < node->getUsername()) return retrieveUserHelper(username, disc, node->_left);
+            if (compare < 0) return retrieveUserHelper(username, disc, node->_left);
             else return retrieveUserHelper(username, disc, node->_right);
         }
     }else{
@@ -451,35 +831,88 @@ DNode* UTree::retrieveUserHelper(string username, int disc, UNode * node){
  * @param username username to match
  * @return number of users with the specified username
  */
-int UTree::numUsers(string username) {
-    return 0; // didnt use this
-}
-
-bool UTree::numUsers(UNode * node){
-    if(node->getDTree()->getNumUsers() > 0) return true;
-    return false;
+int UTree::numUsers(std::string_view username) {
+    UNode* node = retrieve(username);
+    return node ? node->getDTree()->getNumUsers() : 0;
 }
 
 /**
  * Helper for the destructor to clear dynamic memory.
  */
 void UTree::clear() {
-    clearTraverse(this->_root);
+    logOperation(LOG_CLEAR, AccountRef("", INVALID_DISC, false, "", ""));
+
+    // the pool is released all at once, the nodes only need a visit if they hold memory outside of it
+    if (!std::is_trivially_destructible<DNode>::value) clearTraverse(this->_root);
+    this->_root = nullptr;
+    _pool.clear();
+}
+
+void UTree::flattenTraverse(UNode * node, std::vector<UNode*>& nodes){
+    if (!node) return;
+
+    // inorder, so the usernames come out sorted
+    flattenTraverse(node->_left, nodes);
+    nodes.push_back(node);
+    flattenTraverse(node->_right, nodes);
+    node->_left = nullptr;
+    node->_right = nullptr;
+}
+
+UNode * UTree::buildTraverse(const std::vector<UNode*>& nodes, size_t lo, size_t hi){
+    if (lo == hi) return nullptr;
+
+    // the middle node becomes the root, which keeps both sides within one node of each other
+    size_t middle = lo + (hi - lo) / 2;
+    UNode * node = nodes[middle];
+    node->_left = buildTraverse(nodes, lo, middle);
+    node->_right = buildTraverse(nodes, middle + 1, hi);
+    updateHeight(node);
+    return node;
 }
 
 void UTree::clearTraverse(UNode* node){ // traversal for destructor
     if(node){
         clearTraverse(node->_left);
         clearTraverse(node->_right);
-        delete node;
+        node->getDTree()->clear();
+    }
+}
+
+UNode * UTree::makeUNode(std::string_view username){
+    return makeUNode(username, _pool);
+}
+
+UNode * UTree::makeUNode(std::string_view username, NodePool& pool){
+    UNode * node = pool.make<UNode>(&_pool);
+    if (username.size() >= KEY_INLINE){
+        node->_key = static_cast<char*>(pool.allocate(username.size() + 1)); // too long to keep inline
     }
+    char * key = const_cast<char*>(node->_key);
+    std::memcpy(key, username.data(), username.size());
+    key[username.size()] = '\0';
+    node->_keyLength = username.size();
+    node->_dtree._username = node->_key; // the DTree shares the key instead of copying it
+    return node;
+}
+
+void UTree::freeUNode(UNode * node){
+    freeUNode(node, _pool);
+}
+
+void UTree::freeUNode(UNode * node, NodePool& pool){
+    const char * key = (node->_key != node->_inlineKey) ? node->_key : nullptr;
+    int keyLength = node->_keyLength;
+    pool.destroy(node);
+    if (key) pool.release(const_cast<char*>(key), keyLength + 1);
 }
 
 /**
- * Prints all accounts' details within every DTree.
+ * Prints all accounts' details within every DTree, in username and then discriminator order.
  */
 void UTree::printUsers() const {
-    return;
+    Cursor cursor(*this);
+    while (cursor.next()) cout << cursor.current()->getAccount() << endl;
 }
 
 /**
@@ -566,7 +999,7 @@ UNode* UTree::rebalance(UNode* node) {
 
 
     if (balance < -1){
-        if (checkImbalance(node->_right) > 1){
+        if (checkImbalance(node->_right) > 0){
             node->_right = right(node->_right);
             return left(node);
         }else{
@@ -574,7 +1007,7 @@ UNode* UTree::rebalance(UNode* node) {
         }
     }
     if (balance > 1){
-        if (checkImbalance(node->_left) < -1){
+        if (checkImbalance(node->_left) < 0){
  
             node->_left = left(node->_left);
             return right(node);
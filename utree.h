@@ -8,41 +8,75 @@
 #pragma once
 
 #include "dtree.h"
+#include "oplog.h"
+#include "nodelock.h"
 #include <fstream>
 #include <sstream>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <charconv>
+#include <thread>
+#include <functional>
+#include <atomic>
+#include <memory>
 
 #define DEFAULT_HEIGHT 0
+#define KEY_INLINE 32 // usernames shorter than this are kept inside the UNode itself
 
 class Grader;   /* For grading purposes */
 class Tester;   /* Forward declaration for testing class */
 
+/* A line of an input file that could not be loaded */
+struct LoadError {
+    int line; // 1-based, 0 when the whole file is at fault
+    const char* reason;
+};
+
+/* What loadData did with an input file */
+struct LoadReport {
+    bool opened = false;
+    int lines = 0; // lines read, blank ones included
+    int parsed = 0; // lines that made it into an account
+    int loaded = 0; // accounts inserted, parsed ones whose discriminator was taken are left out
+    std::vector<LoadError> errors; // every rejected line, in file order
+
+    bool ok() const {return opened && errors.empty();}
+};
+
 class UNode {
     friend class Grader;
     friend class Tester;
     friend class UTree;
+    friend class ConcurrentUTree;
+    friend class Cursor;
 public:
-    UNode() {
-        _dtree = new DTree();
+    UNode(): UNode(nullptr) {}
+
+    UNode(NodePool* pool): _dtree(pool) {
+        _key = _inlineKey;
+        _keyLength = 0;
+        _inlineKey[0] = '\0';
         _height = DEFAULT_HEIGHT;
         _left = nullptr;
         _right = nullptr;
     }
 
-    ~UNode() {
-        delete _dtree;
-        _dtree = nullptr;
-    }
-
     /* Getters */
-    DTree*& getDTree() {return _dtree;}
+    DTree* getDTree() {return &_dtree;}
     int getHeight() const {return _height;}
-    string getUsername() const {return _dtree->getUsername();}
+    std::string_view getUsername() const {return std::string_view(_key, _keyLength);}
 
 private:
-    DTree* _dtree;
+    // everything a descent looks at comes first, so a short key shares a cache line with the links
+    const char* _key; // points at _inlineKey unless the username is too long for it
+    int _keyLength;
     int _height;
     UNode* _left;
     UNode* _right;
+    char _inlineKey[KEY_INLINE];
+    DTree _dtree; // uses _key as its username
+    NodeLock _lock; // guards _dtree when the tree is shared between threads
 
     /* IMPLEMENT (optional): Additional helper functions */
 
@@ -51,21 +85,36 @@ private:
 class UTree {
     friend class Grader;
     friend class Tester;
+    friend class ConcurrentUTree;
+    friend class ShardedUTree;
+    friend class Cursor;
 
 public:
-    UTree():_root(nullptr){}
+    UTree():_root(nullptr), _sequence(0), _logWaits(true){}
 
     /* IMPLEMENT: destructor */
     ~UTree();
 
     /* IMPLEMENT: Basic operations */
 
-    void loadData(string infile, bool append = true);
-    bool insert(Account newAcct);
-    bool removeUser(string username, int disc, DNode*& removed);
-    UNode* retrieve(string username);
-    DNode* retrieveUser(string username, int disc);
-    int numUsers(string username);
+    LoadReport loadData(string infile, bool append = true, int numThreads = 1);
+    int bulkLoad(std::vector<AccountRef>& accounts);
+    bool saveSnapshot(const string& path) const;
+    bool loadSnapshot(const string& path);
+    bool openLog(const string& snapshotPath, const string& logPath, int syncEvery = LOG_SYNC_EVERY);
+    bool checkpoint();
+    bool syncLog();
+    void closeLog();
+    bool insert(const Account& newAcct);
+    bool emplace(std::string_view username, int disc, bool nitro, std::string_view badge, std::string_view status);
+    int allocateDiscriminator(const Account& newAcct, AllocPolicy policy, std::mt19937& rng);
+    int insertBatch(const Account* accounts, size_t count, std::vector<bool>& results);
+    bool removeUser(std::string_view username, int disc);
+    bool removeUser(std::string_view username, int disc, Account& removed);
+    int removeBatch(const std::pair<std::string_view, int>* users, size_t count, std::vector<bool>& results);
+    UNode* retrieve(std::string_view username);
+    DNode* retrieveUser(std::string_view username, int disc);
+    int numUsers(std::string_view username);
     void clear();
     void printUsers() const;
     void dump() const {dump(_root);}
@@ -84,22 +133,50 @@ public:
 
 private:
     UNode* _root;
+    NodePool _pool; // every UNode, DTree and DNode of this tree lives in here
+    OpLog _log; // while open, every change is logged to it
+    string _snapshotPath; // where checkpoints of the log go
+    std::atomic<uint64_t> _sequence; // sequence number of the last change, logged or not
+    bool _logWaits; // false if whoever calls in waits for the log itself, once its locks are let go
 
     /* IMPLEMENT (optional): any additional helper functions here! */
-    bool numUsers(UNode * node);
     int max(int a, int b);
-    void insertHelper(Account newAcct, UNode *& node);
-    void removeHelper(string username, int disc, UNode * node, DNode *& removed);
-    void updateLeftHeights(UNode * node);
-    UNode * findLowestParent(UNode * node); // finds the second lowest node from the selected subtree
-    bool isLeaf(UNode * node); // checks if node is a leaf or not
-    int oneSubtree(UNode * node); // checks if node only has one subtree
-    UNode * rootSearch(UNode * node); // searches for the new root of the delete nodes subtree
-    UNode * retrieveHelper(string username, UNode * node);
-    DNode * retrieveUserHelper(string username, int disc, UNode* node);
+    void insertHelper(const AccountRef& account, UNode *& node, DNode *& inserted);
+    bool removeAccount(std::string_view username, int disc, Account* removed); // removeUser, handing the account out first when removed is set
+    bool pruneUNode(std::string_view username); // unlinks the UNode of username if it has no accounts left
+    void pruneHelper(std::string_view username, UNode *& node, bool& pruned); // recursive helper for pruneUNode
+    void unlinkUNode(UNode *& node); // splices a UNode out of the tree and frees it, the caller rebalances
+    UNode * detachMin(UNode *& node); // unlinks the smallest username of a subtree, rebalancing the path to it
+    int applyBatch(std::vector<AccountRef>& batch, LogOp op, std::vector<bool>& results); // sorts a batch, runs it through the tree and logs what got done
+    void insertBatchHelper(UNode *& node, const AccountRef* accounts, bool* done, size_t count, int& inserted); // recursive helper for insertBatch
+    void settleBatch(UNode *& node); // updates a UNode a batch went through and fixes any imbalance under it
+    void removeBatchHelper(UNode *& node, const AccountRef* users, const int* discs, bool* done, size_t count, int& removed); // recursive helper for removeBatch
+    static void splitBatch(const AccountRef* accounts, size_t count, std::string_view username, size_t& lo, size_t& hi); // finds the run of a sorted batch with username
+    UNode * retrieveHelper(std::string_view username, UNode * node);
+    DNode * retrieveUserHelper(std::string_view username, int disc, UNode* node);
     UNode * left(UNode * node);
     UNode * right(UNode * node);
     void clearTraverse(UNode * node);
+    void flattenTraverse(UNode * node, std::vector<UNode*>& nodes); // unlinks every UNode into a sorted list
+    UNode * buildTraverse(const std::vector<UNode*>& nodes, size_t lo, size_t hi); // builds a balanced subtree out of nodes[lo, hi)
+    UNode * makeUNode(std::string_view username); // allocates a UNode and its DTree out of the pool
+    UNode * makeUNode(std::string_view username, NodePool& pool); // same, out of another pool that gets merged into this tree's
+    int bulkLoadHelper(std::vector<AccountRef>& accounts); // bulkLoad without the checkpoint
+    void restoreExisting(std::vector<UNode*>& existing); // puts the flattened UNodes back as the tree after a load threw
+    void logOperation(LogOp op, const AccountRef& account); // appends a change to the log if there is one
+    uint64_t logEnqueue(LogOp op, const AccountRef& account); // same without waiting, returns the log's ticket or 0
+    void replayOperation(const LogRecord& record); // applies a change read back from the log
+    int parallelLoad(std::vector<std::vector<AccountRef>>& chunks); // bulkLoad with one username range per sorted chunk's thread
+    int mergeAccounts(const AccountRef* accounts, size_t numAccounts, UNode* const* existing, size_t numExisting,
+                      NodePool& pool, std::vector<UNode*>& nodes); // merges sorted accounts into sorted UNodes, new nodes come from pool
+    void parseChunk(const char* begin, const char* end, std::vector<AccountRef>& accounts, LoadReport& report); // parses whole lines of a CSV
+    static bool parseInt(std::string_view field, int& value); // parses a CSV field as an int without copying it
+    static bool accountLess(const AccountRef& a, const AccountRef& b); // orders accounts by username, then discriminator
+    static void runParallel(int numThreads, const std::function<void(int)>& task); // runs task(0) to task(numThreads - 1) at once
+    void freeUNode(UNode * node); // gives a UNode, its DTree and its DNodes back to the pool
+    void freeUNode(UNode * node, NodePool& pool); // same, into the pool the UNode came from
+    void snapshotTraverse(UNode * node, SnapshotWriter& writer) const; // appends the subtree to a snapshot in pre-order
+    UNode * restoreTraverse(SnapshotReader& reader, bool& ok); // rebuilds a subtree from the next snapshot records
 
 
     //UNode * leftRightHelper(UNode * node);
@@ -0,0 +1,439 @@
+/**
+ * Version.cpp
+ * Implementation for the VersionedUTree and Version classes.
+ */
+
+#include "version.h"
+#include "snapshot.h"
+
+VersionedUTree::VersionedUTree(): _root(nullptr), _epoch(0), _stamp(0), _numReclaimed(0) {}
+
+/**
+ * Destructor, the pool takes every node and string of every version with it.
+ */
+VersionedUTree::~VersionedUTree() {}
+
+/**
+ * Inserts an account, copying the path to it.
+ * @param newAcct Account object to be inserted
+ * @return true if the account was inserted, false if its discriminator was taken or invalid
+ */
+bool VersionedUTree::insert(const Account& newAcct) {
+    return emplace(newAcct.getUsername(), newAcct.getDiscriminator(), newAcct.hasNitro(), newAcct.getBadge(), newAcct.getStatus());
+}
+
+/**
+ * Inserts an account built straight from its fields, copying the path to it.
+ * Readers keep seeing the version without it until the new root is published.
+ * @return true if the account was inserted, false if its discriminator was taken or invalid
+ */
+bool VersionedUTree::emplace(std::string_view username, int disc, bool nitro, std::string_view badge, std::string_view status) {
+    if (disc < MIN_DISC || disc > MAX_DISC || status.size() > MAX_STATUS_LENGTH) return false;
+    if (BadgeTable::intern(badge) == INVALID_BADGE) return false; // interned here, so insertAccount cannot fail
+    AccountRef account(username, disc, nitro, badge, status);
+
+    std::lock_guard<std::mutex> guard(_writer);
+    _stamp++;
+    bool inserted = false;
+    VUNode* root = insertHelper(_root.load(std::memory_order_relaxed), account, inserted);
+    if (inserted) publish(root);
+    return inserted;
+}
+
+/**
+ * Removes a user, copying the path to it. A username goes with its last account.
+ * @param username username to match
+ * @param disc discriminator to match
+ * @return true if an account was removed, false otherwise
+ */
+bool VersionedUTree::removeUser(std::string_view username, int disc) {
+    std::lock_guard<std::mutex> guard(_writer);
+    _stamp++;
+    bool removed = false;
+    VUNode* root = removeHelper(_root.load(std::memory_order_relaxed), username, disc, removed);
+    if (removed) publish(root);
+    return removed;
+}
+
+/**
+ * Copies out the account of a user from the current version.
+ * @param username username to match
+ * @param disc discriminator to match
+ * @param found set to the account if the user exists
+ * @return true if the user exists
+ */
+bool VersionedUTree::retrieveUser(std::string_view username, int disc, Account& found) const {
+    return current().retrieveUser(username, disc, found);
+}
+
+/**
+ * Returns the number of users with a specific username in the current version.
+ * @param username username to match
+ * @return number of users with the specified username
+ */
+int VersionedUTree::numUsers(std::string_view username) const {
+    return current().numUsers(username);
+}
+
+/**
+ * Takes hold of the current version. Never waits, whatever the writers are doing.
+ * @return the version, frozen for as long as it is held
+ */
+Version VersionedUTree::current() const {
+    std::atomic<int>* readers = &_slots[threadSlot()].readers[_epoch.load() & 1];
+    readers->fetch_add(1);
+    // the root is loaded after the reader is counted, so a writer either sees the count
+    // or is already done retiring anything older than this root
+    return Version(_root.load(), readers);
+}
+
+/**
+ * Removes every account. Versions taken before keep theirs.
+ */
+void VersionedUTree::clear() {
+    std::lock_guard<std::mutex> guard(_writer);
+    _stamp++;
+    retireTraverse(_root.load(std::memory_order_relaxed));
+    publish(nullptr);
+}
+
+VUNode* VersionedUTree::insertHelper(VUNode* node, const AccountRef& account, bool& inserted){
+    if (!node){ // new username, its accounts start out with this one
+        VUNode* user = _pool.make<VUNode>();
+        user->key = copyString(account.username, true);
+        user->keyLength = account.username.size();
+        user->stamp = _stamp;
+        user->accounts = insertAccount(nullptr, account, inserted);
+        user->numUsers = 1;
+        return user;
+    }
+
+    int compare = account.username.compare(node->getUsername());
+    if (compare == 0){
+        VDNode* accounts = insertAccount(node->accounts, account, inserted);
+        if (!inserted) return node;
+        node = own(node);
+        node->accounts = accounts;
+        node->numUsers++;
+        return node;
+    }
+
+    VUNode* child = insertHelper(compare < 0 ? node->left : node->right, account, inserted);
+    if (!inserted) return node; // nothing below changed, so neither does this node
+    node = own(node);
+    (compare < 0 ? node->left : node->right) = child;
+    return rebalance(node);
+}
+
+VDNode* VersionedUTree::insertAccount(VDNode* node, const AccountRef& account, bool& inserted){
+    if (!node){
+        VDNode* added = _pool.make<VDNode>();
+        added->status = copyString(account.status, false);
+        added->statusLength = account.status.size();
+        added->stamp = _stamp;
+        added->disc = account.disc;
+        added->badge = BadgeTable::intern(account.badge);
+        added->nitro = account.nitro;
+        inserted = true;
+        return added;
+    }
+
+    if (account.disc == node->disc) return node; // discriminator is already taken
+    VDNode* child = insertAccount(account.disc < node->disc ? node->left : node->right, account, inserted);
+    if (!inserted) return node;
+    node = own(node);
+    (account.disc < node->disc ? node->left : node->right) = child;
+    return rebalance(node);
+}
+
+VUNode* VersionedUTree::removeHelper(VUNode* node, std::string_view username, int disc, bool& removed){
+    if (!node) return nullptr;
+
+    int compare = username.compare(node->getUsername());
+    if (compare == 0){
+        VDNode* accounts = removeAccount(node->accounts, disc, removed);
+        if (!removed) return node;
+        if (node->numUsers > 1){
+            node = own(node);
+            node->accounts = accounts;
+            node->numUsers--;
+            return node;
+        }
+        retire(const_cast<char*>(node->key), node->keyLength + 1); // last account gone, the username goes with it
+        return unlink(node);
+    }
+
+    VUNode* child = removeHelper(compare < 0 ? node->left : node->right, username, disc, removed);
+    if (!removed) return node;
+    node = own(node);
+    (compare < 0 ? node->left : node->right) = child;
+    return rebalance(node);
+}
+
+VDNode* VersionedUTree::removeAccount(VDNode* node, int disc, bool& removed){
+    if (!node) return nullptr;
+
+    if (disc == node->disc){
+        removed = true;
+        if (node->status) retire(const_cast<char*>(node->status), node->statusLength);
+        return unlink(node);
+    }
+
+    VDNode* child = removeAccount(disc < node->disc ? node->left : node->right, disc, removed);
+    if (!removed) return node;
+    node = own(node);
+    (disc < node->disc ? node->left : node->right) = child;
+    return rebalance(node);
+}
+
+template <class Node>
+Node* VersionedUTree::own(Node* node){
+    if (node->stamp == _stamp) return node; // made by this write, nobody else has seen it yet
+    Node* copy = _pool.make<Node>(*node);
+    copy->stamp = _stamp;
+    retire(node, sizeof(Node));
+    return copy;
+}
+
+template <class Node>
+Node* VersionedUTree::rebalance(Node* node){
+    int balance = height(node->left) - height(node->right);
+    if (balance > 1){
+        node->left = own(node->left);
+        if (height(node->left->left) < height(node->left->right)) node->left = rotateLeft(node->left);
+        return rotateRight(node);
+    }
+    if (balance < -1){
+        node->right = own(node->right);
+        if (height(node->right->right) < height(node->right->left)) node->right = rotateRight(node->right);
+        return rotateLeft(node);
+    }
+    node->height = std::max(height(node->left), height(node->right)) + 1;
+    return node;
+}
+
+template <class Node>
+Node* VersionedUTree::rotateLeft(Node* node){
+    Node* right = own(node->right);
+    node->right = right->left;
+    right->left = node;
+    node->height = std::max(height(node->left), height(node->right)) + 1; // node is now below right, so it goes first
+    right->height = std::max(height(right->left), height(right->right)) + 1;
+    return right;
+}
+
+template <class Node>
+Node* VersionedUTree::rotateRight(Node* node){
+    Node* left = own(node->left);
+    node->left = left->right;
+    left->right = node;
+    node->height = std::max(height(node->left), height(node->right)) + 1;
+    left->height = std::max(height(left->left), height(left->right)) + 1;
+    return left;
+}
+
+template <class Node>
+Node* VersionedUTree::removeMin(Node* node, Node*& min){
+    if (!node->left){
+        min = node;
+        return node->right;
+    }
+    node = own(node);
+    node->left = removeMin(node->left, min);
+    return rebalance(node);
+}
+
+template <class Node>
+Node* VersionedUTree::unlink(Node* node){
+    Node* replacement;
+    if (!node->left || !node->right){
+        replacement = node->left ? node->left : node->right; // the subtree moves up as it is
+    }else{
+        Node* min = nullptr;
+        Node* right = removeMin(node->right, min);
+        replacement = own(min);
+        replacement->left = node->left;
+        replacement->right = right;
+        replacement = rebalance(replacement);
+    }
+    retire(node, sizeof(Node));
+    return replacement;
+}
+
+void VersionedUTree::retire(void* block, size_t bytes){
+    _retired[_epoch.load(std::memory_order_relaxed) & 1].push_back({block, bytes});
+}
+
+void VersionedUTree::retireTraverse(VUNode* node){
+    if (!node) return;
+    retireTraverse(node->left);
+    retireTraverse(node->right);
+    retireTraverse(node->accounts);
+    retire(const_cast<char*>(node->key), node->keyLength + 1);
+    retire(node, sizeof(VUNode));
+}
+
+void VersionedUTree::retireTraverse(VDNode* node){
+    if (!node) return;
+    retireTraverse(node->left);
+    retireTraverse(node->right);
+    if (node->status) retire(const_cast<char*>(node->status), node->statusLength);
+    retire(node, sizeof(VDNode));
+}
+
+void VersionedUTree::publish(VUNode* root){
+    _root.store(root);
+    reclaim();
+}
+
+void VersionedUTree::reclaim(){
+    if (_retired[0].size() + _retired[1].size() < VERSION_RECLAIM_BATCH) return; // not worth a look at every slot yet
+
+    // what was retired in the previous epoch is safe once nobody who started back then is left,
+    // anyone who started later loaded a root that no longer reaches it
+    uint64_t epoch = _epoch.load();
+    int previous = (epoch + 1) & 1;
+    for (const Slot& slot : _slots){
+        if (slot.readers[previous].load() != 0) return;
+    }
+    for (const Retired& retired : _retired[previous]) _pool.release(retired.block, retired.bytes);
+    _numReclaimed += _retired[previous].size();
+    _retired[previous].clear();
+    _epoch.store(epoch + 1); // retiring goes on into the list that was just emptied
+}
+
+const char* VersionedUTree::copyString(std::string_view text, bool terminate){
+    size_t bytes = text.size() + (terminate ? 1 : 0);
+    if (bytes == 0) return nullptr;
+    char* copy = static_cast<char*>(_pool.allocate(bytes));
+    std::memcpy(copy, text.data(), text.size());
+    if (terminate) copy[text.size()] = '\0';
+    return copy;
+}
+
+Version::Version(Version&& rhs): _root(rhs._root), _readers(rhs._readers) {
+    rhs._readers = nullptr;
+}
+
+/**
+ * Destructor, lets the writers free what only this version could still reach.
+ */
+Version::~Version() {
+    if (_readers) _readers->fetch_sub(1, std::memory_order_release);
+}
+
+/**
+ * Copies out the account of a user.
+ * @param username username to match
+ * @param disc discriminator to match
+ * @param found set to the account if the user exists
+ * @return true if the user exists
+ */
+bool Version::retrieveUser(std::string_view username, int disc, Account& found) const {
+    const VDNode* user = retrieve(username, disc);
+    if (!user) return false;
+    found = Account(string(username), user->disc, user->nitro, user->getBadge(), string(user->getStatus()));
+    return true;
+}
+
+/**
+ * Finds the account of a user without copying it.
+ * @param username username to match
+ * @param disc discriminator to match
+ * @return the account, valid for as long as the version is held, nullptr if there is none
+ */
+const VDNode* Version::retrieve(std::string_view username, int disc) const {
+    const VUNode* user = retrieveHelper(username);
+    const VDNode* node = user ? user->accounts : nullptr;
+    while (node && node->disc != disc) node = disc < node->disc ? node->left : node->right;
+    return node;
+}
+
+/**
+ * Returns the number of users with a specific username.
+ * @param username username to match
+ * @return number of users with the specified username
+ */
+int Version::numUsers(std::string_view username) const {
+    const VUNode* user = retrieveHelper(username);
+    return user ? user->numUsers : 0;
+}
+
+/**
+ * Calls callback with every account of the version, ordered by username and
+ * then discriminator. The views it gets are valid while the version is held.
+ * @param callback called once per account
+ */
+void Version::forEach(const std::function<void(const AccountRef&)>& callback) const {
+    forEachTraverse(_root, callback);
+}
+
+/**
+ * Writes the version to a snapshot that UTree::loadSnapshot can restore,
+ * while writers carry on with newer versions.
+ * @param path file to write the snapshot to
+ * @return true if the snapshot was written
+ */
+bool Version::saveSnapshot(const string& path) const {
+    SnapshotWriter writer;
+    writer.addBadges();
+    snapshotTraverse(_root, writer);
+    return writeSnapshot(path, writer, 0); // versions are not logged, so there is no sequence to carry on from
+}
+
+const VUNode* Version::retrieveHelper(std::string_view username) const{
+    const VUNode* node = _root;
+    while (node){
+        int compare = username.compare(node->getUsername());
+        if (compare == 0) return node;
+        node = compare < 0 ? node->left : node->right;
+    }
+    return nullptr;
+}
+
+void Version::forEachTraverse(const VUNode* node, const std::function<void(const AccountRef&)>& callback) const{
+    if (!node) return;
+    forEachTraverse(node->left, callback);
+    forEachTraverse(node, node->accounts, callback);
+    forEachTraverse(node->right, callback);
+}
+
+void Version::forEachTraverse(const VUNode* user, const VDNode* node, const std::function<void(const AccountRef&)>& callback) const{
+    if (!node) return;
+    forEachTraverse(user, node->left, callback);
+    callback(AccountRef(user->getUsername(), node->disc, node->nitro, node->getBadge(), node->getStatus()));
+    forEachTraverse(user, node->right, callback);
+}
+
+void Version::snapshotTraverse(const VUNode* node, SnapshotWriter& writer) const{
+    if (!node) return;
+
+    size_t index = writer.unodes.size();
+    SnapshotUNode record = {};
+    record.keyOffset = writer.addString(node->getUsername(), true);
+    record.keyLength = node->keyLength;
+    record.flags = (node->left ? SNAPSHOT_LEFT : 0) | (node->right ? SNAPSHOT_RIGHT : 0);
+    writer.unodes.push_back(record);
+
+    size_t before = writer.dnodes.size();
+    snapshotTraverse(node->accounts, writer);
+    writer.unodes[index].numDNodes = writer.dnodes.size() - before;
+
+    snapshotTraverse(node->left, writer);
+    snapshotTraverse(node->right, writer);
+}
+
+void Version::snapshotTraverse(const VDNode* node, SnapshotWriter& writer) const{
+    if (!node) return;
+
+    SnapshotDNode record = {};
+    record.statusOffset = node->statusLength ? writer.addString(node->getStatus(), false) : 0;
+    record.statusLength = node->statusLength;
+    record.disc = node->disc;
+    record.badge = node->badge;
+    record.flags = (node->nitro ? SNAPSHOT_NITRO : 0) | (node->left ? SNAPSHOT_LEFT : 0) | (node->right ? SNAPSHOT_RIGHT : 0);
+    writer.dnodes.push_back(record);
+
+    snapshotTraverse(node->left, writer);
+    snapshotTraverse(node->right, writer);
+}
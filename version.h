@@ -0,0 +1,160 @@
+/**
+ * Version.h
+ * An interface for the VersionedUTree class, a UTree whose readers see
+ * frozen versions of it while writers carry on.
+ */
+
+#pragma once
+
+#include "dtree.h"
+#include "nodelock.h"
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <functional>
+
+#define VERSION_RECLAIM_BATCH 1024 // retired blocks a writer lets pile up before it tries to free them
+
+class Grader;   /* For grading purposes */
+class Tester;   /* Forward declaration for testing class */
+struct SnapshotWriter;
+
+/* An account of a version. Never changes once a version holding it is published */
+struct VDNode {
+    VDNode* left;
+    VDNode* right;
+    const char* status; // in the pool, shared by every copy of the node
+    uint64_t stamp; // write that made the node, only that write may change it
+    uint16_t statusLength;
+    int16_t disc;
+    uint8_t badge; // id in the BadgeTable
+    bool nitro;
+    int8_t height;
+
+    int getDiscriminator() const {return disc;}
+    bool hasNitro() const {return nitro;}
+    const string& getBadge() const {return BadgeTable::name(badge);}
+    std::string_view getStatus() const {return std::string_view(status ? status : "", statusLength);}
+};
+
+/* A username of a version with its accounts, which are an AVL tree of their own */
+struct VUNode {
+    VUNode* left;
+    VUNode* right;
+    VDNode* accounts;
+    const char* key; // in the pool and null terminated, shared by every copy of the node
+    uint32_t keyLength;
+    int32_t numUsers;
+    uint64_t stamp;
+    int8_t height;
+
+    std::string_view getUsername() const {return std::string_view(key, keyLength);}
+};
+
+class VersionedUTree;
+
+/**
+ * A frozen version of a VersionedUTree. Nothing reachable from it is changed
+ * or freed while it is held, no matter what gets written meanwhile, so it
+ * can be walked at leisure. Holding one keeps every node retired since from
+ * being freed, so it should not be kept for longer than needed.
+ */
+class Version {
+    friend class Grader;
+    friend class Tester;
+    friend class VersionedUTree;
+
+public:
+    Version(Version&& rhs);
+    ~Version();
+    Version(const Version&) = delete;
+    Version& operator=(const Version&) = delete;
+    Version& operator=(Version&&) = delete;
+
+    bool retrieveUser(std::string_view username, int disc, Account& found) const;
+    const VDNode* retrieve(std::string_view username, int disc) const;
+    int numUsers(std::string_view username) const;
+    void forEach(const std::function<void(const AccountRef&)>& callback) const;
+    bool saveSnapshot(const string& path) const;
+
+private:
+    const VUNode* _root;
+    std::atomic<int>* _readers; // counter this version is counted in, nullptr once moved from
+
+    Version(const VUNode* root, std::atomic<int>* readers): _root(root), _readers(readers) {}
+    const VUNode* retrieveHelper(std::string_view username) const;
+    void forEachTraverse(const VUNode* node, const std::function<void(const AccountRef&)>& callback) const; // in username order
+    void forEachTraverse(const VUNode* user, const VDNode* node, const std::function<void(const AccountRef&)>& callback) const; // in discriminator order
+    void snapshotTraverse(const VUNode* node, SnapshotWriter& writer) const; // appends the subtree to a snapshot in pre-order
+    void snapshotTraverse(const VDNode* node, SnapshotWriter& writer) const; // appends the accounts of a username in pre-order
+};
+
+/**
+ * UTree that never changes a node a reader can see. Every write copies the
+ * nodes on its path, O(log n) UNodes and O(log m) DNodes, links the copies to
+ * whatever it did not touch and publishes the new root with one atomic
+ * store. Readers load the root and never take a lock or wait on anyone;
+ * whatever root they loaded stays whole for as long as they hold it.
+ *
+ * Writers go one at a time. The nodes a write replaces are retired and only
+ * freed once no reader can still reach them, with epoch based reclamation:
+ * readers count themselves in a per-thread counter of the epoch they started
+ * in, and the writer only moves the epoch on, freeing what was retired in
+ * the previous one, once the counters of the previous epoch have drained.
+ */
+class VersionedUTree {
+    friend class Grader;
+    friend class Tester;
+    friend class Version;
+
+public:
+    VersionedUTree();
+    ~VersionedUTree(); // every Version must be gone by now
+    VersionedUTree(const VersionedUTree&) = delete;
+    VersionedUTree& operator=(const VersionedUTree&) = delete;
+
+    bool insert(const Account& newAcct);
+    bool emplace(std::string_view username, int disc, bool nitro, std::string_view badge, std::string_view status);
+    bool removeUser(std::string_view username, int disc);
+    bool retrieveUser(std::string_view username, int disc, Account& found) const;
+    int numUsers(std::string_view username) const;
+    Version current() const;
+    void clear();
+
+private:
+    struct alignas(CACHE_LINE) Slot {
+        std::atomic<int> readers[2]{}; // indexed by the parity of the epoch a reader started in
+    };
+
+    struct Retired {
+        void* block;
+        size_t bytes;
+    };
+
+    std::atomic<VUNode*> _root;
+    std::atomic<uint64_t> _epoch;
+    mutable Slot _slots[TREELOCK_SLOTS];
+    std::mutex _writer; // lets one writer at a time in
+    NodePool _pool; // only touched by the writer
+    uint64_t _stamp; // stamp of the write in progress
+    std::vector<Retired> _retired[2]; // indexed by the parity of the epoch they were retired in
+    uint64_t _numReclaimed;
+
+    VUNode* insertHelper(VUNode* node, const AccountRef& account, bool& inserted); // returns the new subtree
+    VDNode* insertAccount(VDNode* node, const AccountRef& account, bool& inserted);
+    VUNode* removeHelper(VUNode* node, std::string_view username, int disc, bool& removed);
+    VDNode* removeAccount(VDNode* node, int disc, bool& removed);
+    template <class Node> Node* own(Node* node); // the node itself if this write made it, otherwise a copy of it
+    template <class Node> Node* rebalance(Node* node); // node must be owned
+    template <class Node> Node* rotateLeft(Node* node);
+    template <class Node> Node* rotateRight(Node* node);
+    template <class Node> Node* removeMin(Node* node, Node*& min); // unlinks the leftmost node of the subtree
+    template <class Node> Node* unlink(Node* node); // replaces a node by its successor, returns the new subtree
+    template <class Node> static int height(const Node* node) {return node ? node->height : -1;}
+    void retire(void* block, size_t bytes); // frees a block once no reader can reach it
+    void retireTraverse(VUNode* node); // retires a whole version, for clear
+    void retireTraverse(VDNode* node);
+    void publish(VUNode* root); // makes root the current version
+    void reclaim(); // moves the epoch on and frees what is old enough, if no reader is in the way
+    const char* copyString(std::string_view text, bool terminate); // copies a string into the pool
+};